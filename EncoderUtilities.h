@@ -0,0 +1,99 @@
+// EncoderUtilities.h
+// Helpers shared by the native image writers.
+//
+// Copyright (c) 2019 Matthew Breit - matt.breit@baslerweb.com or matt.breit@gmail.com
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http ://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <stdint.h>
+
+namespace EncoderUtilities
+{
+	// Runs work(index) for index in [0, count) on up to 'threads' threads and rethrows the first error.
+	template <typename Work>
+	void ParallelFor(size_t count, unsigned int threads, Work work)
+	{
+		if (threads == 0)
+			threads = std::thread::hardware_concurrency();
+		if (threads == 0)
+			threads = 1;
+		if (threads > count)
+			threads = static_cast<unsigned int>(count);
+
+		std::atomic<size_t> nextIndex(0);
+		std::mutex errorMutex;
+		std::string errorMessage;
+
+		auto worker = [&]()
+		{
+			size_t index;
+			while ((index = nextIndex++) < count)
+			{
+				try
+				{
+					work(index);
+				}
+				catch (std::exception &e)
+				{
+					std::lock_guard<std::mutex> lock(errorMutex);
+					if (errorMessage.empty())
+						errorMessage = e.what();
+					nextIndex = count;
+				}
+			}
+		};
+
+		if (threads <= 1)
+		{
+			worker();
+		}
+		else
+		{
+			std::vector<std::thread> pool;
+			for (unsigned int i = 0; i < threads; i++)
+				pool.push_back(std::thread(worker));
+			for (size_t i = 0; i < pool.size(); i++)
+				pool[i].join();
+		}
+
+		if (errorMessage.empty() == false)
+			throw std::runtime_error(errorMessage);
+	}
+
+	inline void WriteFile(const std::string& fileName, const std::vector<char>& data)
+	{
+		std::ofstream outFile(fileName.c_str(), std::ofstream::binary | std::ofstream::out | std::ofstream::trunc);
+		if (outFile)
+			outFile.write(data.empty() ? NULL : &data[0], data.size());
+
+		if (!outFile)
+		{
+			std::string errorMessage = "ERROR: ";
+			errorMessage.append(__FUNCTION__);
+			errorMessage.append("(): Could not write file: ");
+			errorMessage.append(fileName);
+			throw std::runtime_error(errorMessage);
+		}
+	}
+}
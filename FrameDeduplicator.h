@@ -0,0 +1,297 @@
+// FrameDeduplicator.h
+// Detects frames in a batch whose raw data is identical to a frame that was already converted,
+// so the existing output can be hardlinked (or referenced in the archive index) instead of encoded again.
+//
+// Copyright (c) 2019 Matthew Breit - matt.breit@baslerweb.com or matt.breit@gmail.com
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http ://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <iostream>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <stdint.h>
+#ifndef PYLON_WIN_BUILD
+#include <unistd.h> // For link().
+#endif
+
+namespace FrameDeduplicator
+{
+	// XXH64. The main loop runs four independent 64 bit lanes over 32 byte stripes,
+	// which keeps the multipliers busy in parallel and hashes at close to memory bandwidth.
+	const uint64_t Prime1 = 11400714785074694791ULL;
+	const uint64_t Prime2 = 14029467366897019727ULL;
+	const uint64_t Prime3 = 1609587929392839161ULL;
+	const uint64_t Prime4 = 9650029242287828579ULL;
+	const uint64_t Prime5 = 2870177450012600261ULL;
+
+	inline uint64_t RotateLeft(uint64_t value, int bits)
+	{
+		return (value << bits) | (value >> (64 - bits));
+	}
+
+	inline uint64_t Read64(const uint8_t* p)
+	{
+		uint64_t value;
+		memcpy(&value, p, sizeof(value)); // little endian hosts only, like the rest of the converter.
+		return value;
+	}
+
+	inline uint32_t Read32(const uint8_t* p)
+	{
+		uint32_t value;
+		memcpy(&value, p, sizeof(value));
+		return value;
+	}
+
+	inline uint64_t Round(uint64_t accumulator, uint64_t input)
+	{
+		accumulator += input * Prime2;
+		accumulator = RotateLeft(accumulator, 31);
+		return accumulator * Prime1;
+	}
+
+	inline uint64_t MergeRound(uint64_t accumulator, uint64_t value)
+	{
+		accumulator ^= Round(0, value);
+		return accumulator * Prime1 + Prime4;
+	}
+
+	inline uint64_t HashBuffer(const void* pBuffer, size_t size, uint64_t seed = 0)
+	{
+		const uint8_t* p = static_cast<const uint8_t*>(pBuffer);
+		const uint8_t* pEnd = p + size;
+		uint64_t hash;
+
+		if (size >= 32)
+		{
+			uint64_t lanes[4] = { seed + Prime1 + Prime2, seed + Prime2, seed, seed - Prime1 };
+			const uint8_t* pLimit = pEnd - 32;
+			do
+			{
+				for (int lane = 0; lane < 4; lane++)
+					lanes[lane] = Round(lanes[lane], Read64(p + lane * 8));
+				p += 32;
+			} while (p <= pLimit);
+
+			hash = RotateLeft(lanes[0], 1) + RotateLeft(lanes[1], 7) + RotateLeft(lanes[2], 12) + RotateLeft(lanes[3], 18);
+			for (int lane = 0; lane < 4; lane++)
+				hash = MergeRound(hash, lanes[lane]);
+		}
+		else
+		{
+			hash = seed + Prime5;
+		}
+
+		hash += static_cast<uint64_t>(size);
+
+		for (; p + 8 <= pEnd; p += 8)
+			hash = RotateLeft(hash ^ Round(0, Read64(p)), 27) * Prime1 + Prime4;
+		if (p + 4 <= pEnd)
+		{
+			hash = RotateLeft(hash ^ (static_cast<uint64_t>(Read32(p)) * Prime1), 23) * Prime2 + Prime3;
+			p += 4;
+		}
+		for (; p < pEnd; p++)
+			hash = RotateLeft(hash ^ (static_cast<uint64_t>(*p) * Prime5), 11) * Prime1;
+
+		hash ^= hash >> 33;
+		hash *= Prime2;
+		hash ^= hash >> 29;
+		hash *= Prime3;
+		hash ^= hash >> 32;
+		return hash;
+	}
+
+	// Hardlinks sourceFileName to newFileName, replacing newFileName if it exists. Copies if linking is not possible.
+	// Returns true if the file was linked, false if it had to be copied.
+	inline bool LinkOrCopyFile(const std::string& sourceFileName, const std::string& newFileName)
+	{
+		if (sourceFileName == newFileName)
+			return true;
+
+		std::remove(newFileName.c_str());
+
+#ifdef PYLON_WIN_BUILD
+		if (::CreateHardLinkA(newFileName.c_str(), sourceFileName.c_str(), NULL) != 0)
+			return true;
+#else
+		if (link(sourceFileName.c_str(), newFileName.c_str()) == 0)
+			return true;
+#endif
+
+		std::ifstream source(sourceFileName.c_str(), std::ifstream::binary);
+		std::ofstream destination(newFileName.c_str(), std::ofstream::binary | std::ofstream::out | std::ofstream::trunc);
+		if (source && destination)
+			destination << source.rdbuf();
+
+		if (!source || !destination)
+		{
+			std::string errorMessage = "ERROR: ";
+			errorMessage.append(__FUNCTION__);
+			errorMessage.append("(): Could not link or copy ");
+			errorMessage.append(sourceFileName);
+			errorMessage.append(" to ");
+			errorMessage.append(newFileName);
+			throw std::runtime_error(errorMessage);
+		}
+
+		return false;
+	}
+
+	class CFrameDeduplicator
+	{
+	public:
+		CFrameDeduplicator() : m_enabled(false), m_framesChecked(0), m_duplicatesFound(0), m_rawBytesSkipped(0)
+		{
+		}
+
+		void Enable(bool enabled)
+		{
+			m_enabled = enabled;
+		}
+
+		bool IsEnabled() const
+		{
+			return m_enabled;
+		}
+
+		// conversionKey must describe everything that changes the output (geometry, pixel type, format, encoder options).
+		// Returns true and the first output with the same raw data and key, if there is one.
+		// A hash match is confirmed byte for byte before it is trusted. The most recent matching frame is kept in memory,
+		// so a run of identical frames is compared without reading the earlier raw file again; older matches are read from disk.
+		bool FindDuplicate(uint64_t hash, const std::string& conversionKey, const void* pBuffer, size_t size, std::string& existingOutputFileName)
+		{
+			m_framesChecked++;
+
+			std::map<std::string, std::vector<SFrame> >::iterator found = m_frames.find(Key(hash, conversionKey));
+			if (found == m_frames.end())
+				return false;
+
+			for (size_t i = 0; i < found->second.size(); i++)
+			{
+				if (found->second[i].size != size)
+					continue;
+
+				if (found->second[i].rawFileName == m_recentRawFileName)
+				{
+					if (size > 0 && memcmp(&m_recentBuffer[0], pBuffer, size) != 0)
+						continue;
+				}
+				else
+				{
+					if (IsFileEqualToBuffer(found->second[i].rawFileName, pBuffer, size) == false)
+						continue;
+					KeepRecent(found->second[i].rawFileName, pBuffer, size);
+				}
+
+				existingOutputFileName = found->second[i].outputFileName;
+				return true;
+			}
+
+			return false;
+		}
+
+		void RecordConverted(uint64_t hash, const std::string& conversionKey, const void* pBuffer, size_t size, const std::string& rawFileName, const std::string& outputFileName)
+		{
+			KeepRecent(rawFileName, pBuffer, size);
+
+			SFrame frame;
+			frame.rawFileName = rawFileName;
+			frame.outputFileName = outputFileName;
+			frame.size = size;
+			m_frames[Key(hash, conversionKey)].push_back(frame);
+		}
+
+		void RecordDuplicate(const std::string& existingOutputFileName, const std::string& outputFileName, size_t size)
+		{
+			m_duplicatesFound++;
+			m_rawBytesSkipped += size;
+			m_duplicates[existingOutputFileName].push_back(outputFileName);
+		}
+
+		void PrintSummary(std::ostream& out) const
+		{
+			out << std::endl;
+			out << "Deduplication Summary:" << std::endl;
+			out << " Frames checked    : " << m_framesChecked << std::endl;
+			out << " Duplicates found  : " << m_duplicatesFound << std::endl;
+			out << " Raw bytes skipped : " << m_rawBytesSkipped << std::endl;
+
+			std::map<std::string, std::vector<std::string> >::const_iterator it;
+			for (it = m_duplicates.begin(); it != m_duplicates.end(); ++it)
+			{
+				out << " " << it->first << " <- " << it->second.size() << " duplicate(s):";
+				for (size_t i = 0; i < it->second.size(); i++)
+					out << " " << it->second[i];
+				out << std::endl;
+			}
+		}
+
+	private:
+		struct SFrame
+		{
+			std::string rawFileName;
+			std::string outputFileName;
+			size_t size;
+		};
+
+		static std::string Key(uint64_t hash, const std::string& conversionKey)
+		{
+			return std::to_string(hash) + "|" + conversionKey;
+		}
+
+		void KeepRecent(const std::string& rawFileName, const void* pBuffer, size_t size)
+		{
+			const char* pBytes = static_cast<const char*>(pBuffer);
+			m_recentBuffer.assign(pBytes, pBytes + size);
+			m_recentRawFileName = rawFileName;
+		}
+
+		static bool IsFileEqualToBuffer(const std::string& fileName, const void* pBuffer, size_t size)
+		{
+			std::ifstream file(fileName.c_str(), std::ifstream::binary);
+			if (!file)
+				return false;
+
+			const char* pExpected = static_cast<const char*>(pBuffer);
+			std::vector<char> chunk(1024 * 1024);
+			size_t position = 0;
+			while (position < size)
+			{
+				size_t toRead = std::min(chunk.size(), size - position);
+				file.read(&chunk[0], toRead);
+				if (static_cast<size_t>(file.gcount()) != toRead || memcmp(&chunk[0], pExpected + position, toRead) != 0)
+					return false;
+				position += toRead;
+			}
+
+			return true;
+		}
+
+		bool m_enabled;
+		uint64_t m_framesChecked;
+		uint64_t m_duplicatesFound;
+		uint64_t m_rawBytesSkipped;
+		std::map<std::string, std::vector<SFrame> > m_frames;
+		std::map<std::string, std::vector<std::string> > m_duplicates;
+		std::string m_recentRawFileName;
+		std::vector<char> m_recentBuffer;
+	};
+}
@@ -0,0 +1,430 @@
+// FrameStatistics.h
+// Computes per-channel statistics (histogram, min/max/mean, saturated and dead pixel counts) of a raw frame
+// while it is still in memory after loading, and writes them as one JSON or CSV record per file.
+//
+// Copyright (c) 2019 Matthew Breit - matt.breit@baslerweb.com or matt.breit@gmail.com
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http ://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Include files to use the PYLON API.
+#include <pylon/PylonIncludes.h>
+#include <iostream>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cmath>
+#include <stdint.h>
+
+namespace FrameStatistics
+{
+	const size_t ReportHistogramBins = 256;
+	const int SubHistograms = 4; // interleaved so runs of equal values (blank frames) don't serialize on one counter.
+
+	// Which channel each sample belongs to. Bayer channels follow the 2x2 pattern,
+	// everything else repeats every samplesPerPixel samples along a row.
+	struct SChannelLayout
+	{
+		SChannelLayout() : samplesPerPixel(1), bytesPerSample(1), bitDepth(8), bayer(false)
+		{
+		}
+
+		uint32_t samplesPerPixel;
+		uint32_t bytesPerSample;
+		uint32_t bitDepth;
+		bool bayer;
+		std::vector<std::string> channelNames;
+	};
+
+	struct SChannelStatistics
+	{
+		std::string name;
+		uint64_t pixelCount;
+		uint32_t min;
+		uint32_t max;
+		double mean;
+		double standardDeviation;
+		uint64_t saturatedCount; // at or above the largest value for the bit depth.
+		uint64_t deadCount;      // exactly zero.
+		std::vector<uint64_t> histogram; // ReportHistogramBins bins over the full range of the bit depth.
+	};
+
+	struct SFrameStatistics
+	{
+		std::string fileName;
+		uint32_t width;
+		uint32_t height;
+		std::string pixelTypeName;
+		uint32_t bitDepth;
+		std::vector<SChannelStatistics> channels;
+		bool flagged;
+		std::vector<std::string> flagReasons;
+	};
+
+	// Limits in percent. Negative values disable a check.
+	struct SThresholds
+	{
+		SThresholds() : maxSaturatedPercent(-1), maxDeadPercent(-1), minMeanPercent(-1), maxMeanPercent(-1)
+		{
+		}
+
+		bool IsEnabled() const
+		{
+			return maxSaturatedPercent >= 0 || maxDeadPercent >= 0 || minMeanPercent >= 0 || maxMeanPercent >= 0;
+		}
+
+		double maxSaturatedPercent;
+		double maxDeadPercent;
+		double minMeanPercent; // of full scale.
+		double maxMeanPercent; // of full scale.
+	};
+
+	inline SChannelLayout LayoutFromPixelType(Pylon::EPixelType pixelType)
+	{
+		SChannelLayout layout;
+		layout.bitDepth = Pylon::BitDepth(pixelType);
+
+		switch (pixelType)
+		{
+			case Pylon::EPixelType::PixelType_Mono8:
+			case Pylon::EPixelType::PixelType_Mono10:
+			case Pylon::EPixelType::PixelType_Mono12:
+			case Pylon::EPixelType::PixelType_Mono16:
+				layout.channelNames.push_back("Mono");
+				break;
+			case Pylon::EPixelType::PixelType_BayerBG8:
+			case Pylon::EPixelType::PixelType_BayerBG12:
+				layout.bayer = true;
+				layout.channelNames = { "B", "Gb", "Gr", "R" };
+				break;
+			case Pylon::EPixelType::PixelType_BayerGB8:
+			case Pylon::EPixelType::PixelType_BayerGB12:
+				layout.bayer = true;
+				layout.channelNames = { "Gb", "B", "R", "Gr" };
+				break;
+			case Pylon::EPixelType::PixelType_BayerGR8:
+			case Pylon::EPixelType::PixelType_BayerGR12:
+				layout.bayer = true;
+				layout.channelNames = { "Gr", "R", "B", "Gb" };
+				break;
+			case Pylon::EPixelType::PixelType_BayerRG8:
+			case Pylon::EPixelType::PixelType_BayerRG12:
+				layout.bayer = true;
+				layout.channelNames = { "R", "Gr", "Gb", "B" };
+				break;
+			case Pylon::EPixelType::PixelType_RGB8packed:
+				layout.samplesPerPixel = 3;
+				layout.channelNames = { "R", "G", "B" };
+				break;
+			case Pylon::EPixelType::PixelType_BGR8packed:
+				layout.samplesPerPixel = 3;
+				layout.channelNames = { "B", "G", "R" };
+				break;
+			case Pylon::EPixelType::PixelType_YUV422_YUYV_Packed:
+				layout.samplesPerPixel = 2;
+				layout.bitDepth = 8;
+				layout.channelNames = { "Y", "CbCr" };
+				break;
+			default:
+				throw std::runtime_error("Statistics are not supported for this Pixel Type.");
+		}
+
+		layout.bytesPerSample = (layout.bitDepth > 8) ? 2 : 1;
+		return layout;
+	}
+
+	template <typename Sample>
+	void AccumulateHistograms(const uint8_t* pBuffer, uint32_t width, uint32_t height, size_t stride, const SChannelLayout& layout, std::vector<uint32_t>& counts, size_t countsPerChannel)
+	{
+		const size_t samplesPerRow = static_cast<size_t>(width) * layout.samplesPerPixel;
+		const size_t period = layout.bayer ? 2 : layout.samplesPerPixel;
+		const size_t subHistogramSize = countsPerChannel / SubHistograms;
+
+		std::vector<Sample> row(samplesPerRow);
+		for (uint32_t y = 0; y < height; y++)
+		{
+			memcpy(&row[0], pBuffer + y * stride, samplesPerRow * sizeof(Sample));
+			size_t rowBase = layout.bayer ? (y & 1) * 2 : 0;
+
+			// One phase at a time: a fixed stride over the row, all samples of one channel.
+			for (size_t phase = 0; phase < period && phase < samplesPerRow; phase++)
+			{
+				uint32_t* pCounts = &counts[(rowBase + phase) * countsPerChannel];
+				size_t i = phase;
+				for (; i + 3 * period < samplesPerRow; i += 4 * period)
+				{
+					pCounts[row[i]]++;
+					pCounts[subHistogramSize + row[i + period]]++;
+					pCounts[subHistogramSize * 2 + row[i + 2 * period]]++;
+					pCounts[subHistogramSize * 3 + row[i + 3 * period]]++;
+				}
+				for (; i < samplesPerRow; i += period)
+					pCounts[row[i]]++;
+			}
+		}
+	}
+
+	// Everything is derived from exact per-value histograms, so min, max, mean, saturated and dead counts come from one pass.
+	inline void Compute(const void* pBuffer, uint32_t width, uint32_t height, size_t stride, const SChannelLayout& layout, SFrameStatistics& statistics)
+	{
+		const size_t valueCount = (layout.bytesPerSample == 2) ? 65536 : 256;
+		const size_t countsPerChannel = valueCount * SubHistograms;
+		const size_t channelCount = layout.channelNames.size();
+		const uint32_t maxValue = (1u << layout.bitDepth) - 1;
+
+		if (stride < static_cast<size_t>(width) * layout.samplesPerPixel * layout.bytesPerSample)
+			throw std::runtime_error("Stride is smaller than a row.");
+
+		std::vector<uint32_t> counts(countsPerChannel * channelCount, 0);
+		if (layout.bytesPerSample == 2)
+			AccumulateHistograms<uint16_t>(static_cast<const uint8_t*>(pBuffer), width, height, stride, layout, counts, countsPerChannel);
+		else
+			AccumulateHistograms<uint8_t>(static_cast<const uint8_t*>(pBuffer), width, height, stride, layout, counts, countsPerChannel);
+
+		statistics.width = width;
+		statistics.height = height;
+		statistics.bitDepth = layout.bitDepth;
+		statistics.channels.clear();
+		statistics.flagged = false;
+		statistics.flagReasons.clear();
+
+		// Values above the bit depth (garbage in the unused high bits) land in the last report bin.
+		const uint32_t binShift = (layout.bitDepth > 8) ? layout.bitDepth - 8 : 0;
+
+		for (size_t channel = 0; channel < channelCount; channel++)
+		{
+			SChannelStatistics channelStatistics;
+			channelStatistics.name = layout.channelNames[channel];
+			channelStatistics.pixelCount = 0;
+			channelStatistics.min = 0;
+			channelStatistics.max = 0;
+			channelStatistics.saturatedCount = 0;
+			channelStatistics.deadCount = 0;
+			channelStatistics.histogram.assign(ReportHistogramBins, 0);
+
+			const uint32_t* pCounts = &counts[channel * countsPerChannel];
+			double sum = 0;
+			double sumOfSquares = 0;
+			bool foundMin = false;
+
+			for (uint32_t value = 0; value < valueCount; value++)
+			{
+				uint64_t count = 0;
+				for (int sub = 0; sub < SubHistograms; sub++)
+					count += pCounts[sub * valueCount + value];
+				if (count == 0)
+					continue;
+
+				if (foundMin == false)
+				{
+					channelStatistics.min = value;
+					foundMin = true;
+				}
+				channelStatistics.max = value;
+				channelStatistics.pixelCount += count;
+				sum += static_cast<double>(value) * count;
+				sumOfSquares += static_cast<double>(value) * value * count;
+
+				if (value == 0)
+					channelStatistics.deadCount += count;
+				if (value >= maxValue)
+					channelStatistics.saturatedCount += count;
+
+				size_t bin = value >> binShift;
+				channelStatistics.histogram[bin < ReportHistogramBins ? bin : ReportHistogramBins - 1] += count;
+			}
+
+			if (channelStatistics.pixelCount > 0)
+			{
+				channelStatistics.mean = sum / channelStatistics.pixelCount;
+				double variance = (sumOfSquares / channelStatistics.pixelCount) - (channelStatistics.mean * channelStatistics.mean);
+				channelStatistics.standardDeviation = (variance > 0) ? std::sqrt(variance) : 0;
+			}
+			else
+			{
+				channelStatistics.mean = 0;
+				channelStatistics.standardDeviation = 0;
+			}
+
+			statistics.channels.push_back(channelStatistics);
+		}
+	}
+
+	inline void Evaluate(SFrameStatistics& statistics, const SThresholds& thresholds)
+	{
+		const double fullScale = static_cast<double>((1u << statistics.bitDepth) - 1);
+
+		for (size_t channel = 0; channel < statistics.channels.size(); channel++)
+		{
+			const SChannelStatistics& channelStatistics = statistics.channels[channel];
+			if (channelStatistics.pixelCount == 0)
+				continue;
+
+			double saturatedPercent = 100.0 * channelStatistics.saturatedCount / channelStatistics.pixelCount;
+			double deadPercent = 100.0 * channelStatistics.deadCount / channelStatistics.pixelCount;
+			double meanPercent = 100.0 * channelStatistics.mean / fullScale;
+
+			if (thresholds.maxSaturatedPercent >= 0 && saturatedPercent > thresholds.maxSaturatedPercent)
+				statistics.flagReasons.push_back(channelStatistics.name + " saturated " + std::to_string(saturatedPercent) + "%");
+			if (thresholds.maxDeadPercent >= 0 && deadPercent > thresholds.maxDeadPercent)
+				statistics.flagReasons.push_back(channelStatistics.name + " dead " + std::to_string(deadPercent) + "%");
+			if (thresholds.minMeanPercent >= 0 && meanPercent < thresholds.minMeanPercent)
+				statistics.flagReasons.push_back(channelStatistics.name + " too dark, mean " + std::to_string(meanPercent) + "%");
+			if (thresholds.maxMeanPercent >= 0 && meanPercent > thresholds.maxMeanPercent)
+				statistics.flagReasons.push_back(channelStatistics.name + " too bright, mean " + std::to_string(meanPercent) + "%");
+		}
+
+		statistics.flagged = (statistics.flagReasons.empty() == false);
+	}
+
+	// Writes one record per file: JSON Lines by default, CSV (one row per channel) if the file name ends in .csv
+	class CStatisticsReport
+	{
+	public:
+		CStatisticsReport() : m_isCsv(false)
+		{
+		}
+
+		void Open(const std::string& fileName)
+		{
+			std::string errorMessage = "ERROR: ";
+			errorMessage.append(__FUNCTION__);
+			errorMessage.append("(): ");
+
+			m_isCsv = (fileName.length() >= 4 && fileName.compare(fileName.length() - 4, 4, ".csv") == 0);
+			m_reportFile.open(fileName.c_str(), std::ofstream::out | std::ofstream::trunc);
+			if (!m_reportFile)
+				throw std::runtime_error(errorMessage + "Statistics file could not be created: " + fileName);
+
+			if (m_isCsv)
+				m_reportFile << "file,width,height,pixeltype,bitdepth,channel,pixels,min,max,mean,stddev,saturated,dead,flagged,reasons,histogram" << std::endl;
+		}
+
+		bool IsOpen() const
+		{
+			return m_reportFile.is_open();
+		}
+
+		void Write(const SFrameStatistics& statistics)
+		{
+			if (IsOpen() == false)
+				return;
+
+			if (m_isCsv)
+				WriteCsv(statistics);
+			else
+				WriteJson(statistics);
+		}
+
+		void Close()
+		{
+			if (IsOpen())
+				m_reportFile.close();
+		}
+
+	private:
+		static std::string JsonString(const std::string& text)
+		{
+			std::string escaped = "\"";
+			for (size_t i = 0; i < text.length(); i++)
+			{
+				if (text[i] == '"' || text[i] == '\\')
+					escaped += '\\';
+				escaped += text[i];
+			}
+			return escaped + "\"";
+		}
+
+		static std::string CsvString(const std::string& text)
+		{
+			std::string escaped = "\"";
+			for (size_t i = 0; i < text.length(); i++)
+			{
+				if (text[i] == '"')
+					escaped += '"';
+				escaped += text[i];
+			}
+			return escaped + "\"";
+		}
+
+		void WriteJson(const SFrameStatistics& statistics)
+		{
+			m_reportFile << "{\"file\":" << JsonString(statistics.fileName)
+				<< ",\"width\":" << statistics.width
+				<< ",\"height\":" << statistics.height
+				<< ",\"pixelType\":" << JsonString(statistics.pixelTypeName)
+				<< ",\"bitDepth\":" << statistics.bitDepth
+				<< ",\"flagged\":" << (statistics.flagged ? "true" : "false")
+				<< ",\"reasons\":[";
+			for (size_t i = 0; i < statistics.flagReasons.size(); i++)
+				m_reportFile << (i > 0 ? "," : "") << JsonString(statistics.flagReasons[i]);
+			m_reportFile << "],\"channels\":[";
+
+			for (size_t channel = 0; channel < statistics.channels.size(); channel++)
+			{
+				const SChannelStatistics& channelStatistics = statistics.channels[channel];
+				m_reportFile << (channel > 0 ? "," : "")
+					<< "{\"name\":" << JsonString(channelStatistics.name)
+					<< ",\"pixels\":" << channelStatistics.pixelCount
+					<< ",\"min\":" << channelStatistics.min
+					<< ",\"max\":" << channelStatistics.max
+					<< ",\"mean\":" << channelStatistics.mean
+					<< ",\"stddev\":" << channelStatistics.standardDeviation
+					<< ",\"saturated\":" << channelStatistics.saturatedCount
+					<< ",\"dead\":" << channelStatistics.deadCount
+					<< ",\"histogram\":[";
+				for (size_t bin = 0; bin < channelStatistics.histogram.size(); bin++)
+					m_reportFile << (bin > 0 ? "," : "") << channelStatistics.histogram[bin];
+				m_reportFile << "]}";
+			}
+
+			m_reportFile << "]}" << std::endl;
+		}
+
+		void WriteCsv(const SFrameStatistics& statistics)
+		{
+			std::string reasons;
+			for (size_t i = 0; i < statistics.flagReasons.size(); i++)
+				reasons += (i > 0 ? "; " : "") + statistics.flagReasons[i];
+
+			for (size_t channel = 0; channel < statistics.channels.size(); channel++)
+			{
+				const SChannelStatistics& channelStatistics = statistics.channels[channel];
+				m_reportFile << CsvString(statistics.fileName)
+					<< "," << statistics.width
+					<< "," << statistics.height
+					<< "," << CsvString(statistics.pixelTypeName)
+					<< "," << statistics.bitDepth
+					<< "," << CsvString(channelStatistics.name)
+					<< "," << channelStatistics.pixelCount
+					<< "," << channelStatistics.min
+					<< "," << channelStatistics.max
+					<< "," << channelStatistics.mean
+					<< "," << channelStatistics.standardDeviation
+					<< "," << channelStatistics.saturatedCount
+					<< "," << channelStatistics.deadCount
+					<< "," << (statistics.flagged ? 1 : 0)
+					<< "," << CsvString(reasons)
+					<< ",\"";
+				for (size_t bin = 0; bin < channelStatistics.histogram.size(); bin++)
+					m_reportFile << (bin > 0 ? " " : "") << channelStatistics.histogram[bin];
+				m_reportFile << "\"" << std::endl;
+			}
+		}
+
+		bool m_isCsv;
+		std::ofstream m_reportFile;
+	};
+}
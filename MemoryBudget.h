@@ -0,0 +1,370 @@
+// MemoryBudget.h
+// Admission control for conversions: each conversion reserves its estimated peak memory before it starts
+// and waits until enough of the budget is free. The budget is shared by every instance on the machine
+// through a small budget file in the temp directory, so several instances started with the same
+// --max-memory stay under it together. Frames that could never fit are rejected instead of getting the
+// process OOM-killed halfway through.
+//
+// Copyright (c) 2019 Matthew Breit - matt.breit@baslerweb.com or matt.breit@gmail.com
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http ://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#ifdef PYLON_WIN_BUILD
+#include <psapi.h> // For GetProcessMemoryInfo().
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h> // For getrusage().
+#include <sys/file.h> // For flock().
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h> // For kill(), to find budget entries of processes that are gone.
+#include <cerrno>
+#endif
+
+namespace MemoryBudget
+{
+	const uint64_t BytesPerMB = 1024ULL * 1024ULL;
+	const unsigned int PollIntervalMs = 100;
+
+	inline std::string ErrorMessage(const char* function, const std::string& message)
+	{
+		std::string errorMessage = "ERROR: ";
+		errorMessage.append(function);
+		errorMessage.append("(): ");
+		errorMessage.append(message);
+		return errorMessage;
+	}
+
+	inline unsigned long CurrentProcessId()
+	{
+#ifdef PYLON_WIN_BUILD
+		return ::GetCurrentProcessId();
+#else
+		return static_cast<unsigned long>(getpid());
+#endif
+	}
+
+	// An instance that crashed never releases its reservation, so entries of processes that are gone are dropped.
+	inline bool IsProcessAlive(unsigned long processId)
+	{
+#ifdef PYLON_WIN_BUILD
+		HANDLE process = ::OpenProcess(SYNCHRONIZE, FALSE, static_cast<DWORD>(processId));
+		if (process == NULL)
+			return ::GetLastError() == ERROR_ACCESS_DENIED;
+		bool alive = (::WaitForSingleObject(process, 0) == WAIT_TIMEOUT);
+		::CloseHandle(process);
+		return alive;
+#else
+		return kill(static_cast<pid_t>(processId), 0) == 0 || errno == EPERM;
+#endif
+	}
+
+	inline std::string DefaultBudgetFileName()
+	{
+		std::string tempDirectory;
+#ifdef PYLON_WIN_BUILD
+		char tempPath[MAX_PATH];
+		if (::GetTempPathA(MAX_PATH, tempPath) > 0)
+			tempDirectory = tempPath;
+#else
+		const char* pTempDir = getenv("TMPDIR");
+		tempDirectory = (pTempDir != NULL) ? pTempDir : "/tmp";
+		tempDirectory.append("/");
+#endif
+		return tempDirectory + "PylonRawFileConverter.budget";
+	}
+
+	// The budget file holds one "<process id> <reserved MB>" line per instance.
+	// It is opened and locked exclusively for as long as this object is in scope.
+	class CBudgetFile
+	{
+	public:
+		explicit CBudgetFile(const std::string& fileName)
+		{
+#ifdef PYLON_WIN_BUILD
+			m_file = ::CreateFileA(fileName.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+			if (m_file == INVALID_HANDLE_VALUE)
+				throw std::runtime_error(ErrorMessage(__FUNCTION__, "Budget file could not be opened: " + fileName));
+
+			memset(&m_overlapped, 0, sizeof(m_overlapped));
+			if (::LockFileEx(m_file, LOCKFILE_EXCLUSIVE_LOCK, 0, MAXDWORD, MAXDWORD, &m_overlapped) == 0)
+			{
+				::CloseHandle(m_file);
+				throw std::runtime_error(ErrorMessage(__FUNCTION__, "Budget file could not be locked: " + fileName));
+			}
+#else
+			m_file = open(fileName.c_str(), O_RDWR | O_CREAT, 0666);
+			if (m_file < 0)
+				throw std::runtime_error(ErrorMessage(__FUNCTION__, "Budget file could not be opened: " + fileName));
+
+			if (flock(m_file, LOCK_EX) != 0)
+			{
+				close(m_file);
+				throw std::runtime_error(ErrorMessage(__FUNCTION__, "Budget file could not be locked: " + fileName));
+			}
+#endif
+		}
+
+		~CBudgetFile()
+		{
+#ifdef PYLON_WIN_BUILD
+			::UnlockFileEx(m_file, 0, MAXDWORD, MAXDWORD, &m_overlapped);
+			::CloseHandle(m_file);
+#else
+			flock(m_file, LOCK_UN);
+			close(m_file);
+#endif
+		}
+
+		// Reservations in MB by process id, without the ones of processes that are gone.
+		std::map<unsigned long, uint64_t> Read()
+		{
+			std::string contents;
+			char buffer[4096];
+#ifdef PYLON_WIN_BUILD
+			::SetFilePointer(m_file, 0, NULL, FILE_BEGIN);
+			DWORD bytesRead = 0;
+			while (::ReadFile(m_file, buffer, sizeof(buffer), &bytesRead, NULL) != 0 && bytesRead > 0)
+				contents.append(buffer, bytesRead);
+#else
+			lseek(m_file, 0, SEEK_SET);
+			ssize_t bytesRead = 0;
+			while ((bytesRead = read(m_file, buffer, sizeof(buffer))) > 0)
+				contents.append(buffer, static_cast<size_t>(bytesRead));
+#endif
+
+			std::map<unsigned long, uint64_t> entries;
+			std::istringstream lines(contents);
+			unsigned long processId = 0;
+			uint64_t reservedMB = 0;
+			while (lines >> processId >> reservedMB)
+			{
+				if (IsProcessAlive(processId))
+					entries[processId] = reservedMB;
+			}
+			return entries;
+		}
+
+		void Write(const std::map<unsigned long, uint64_t>& entries)
+		{
+			std::ostringstream lines;
+			std::map<unsigned long, uint64_t>::const_iterator it;
+			for (it = entries.begin(); it != entries.end(); ++it)
+				lines << it->first << " " << it->second << "\n";
+			std::string contents = lines.str();
+
+#ifdef PYLON_WIN_BUILD
+			::SetFilePointer(m_file, 0, NULL, FILE_BEGIN);
+			DWORD bytesWritten = 0;
+			bool written = contents.empty() || (::WriteFile(m_file, contents.c_str(), static_cast<DWORD>(contents.size()), &bytesWritten, NULL) != 0 && bytesWritten == contents.size());
+			::SetEndOfFile(m_file);
+#else
+			bool written = (ftruncate(m_file, 0) == 0);
+			if (written && contents.empty() == false)
+				written = (pwrite(m_file, contents.c_str(), contents.size(), 0) == static_cast<ssize_t>(contents.size()));
+#endif
+			if (written == false)
+				throw std::runtime_error(ErrorMessage(__FUNCTION__, "Could not write the budget file."));
+		}
+
+	private:
+		CBudgetFile(const CBudgetFile&);
+		CBudgetFile& operator=(const CBudgetFile&);
+
+#ifdef PYLON_WIN_BUILD
+		HANDLE m_file;
+		OVERLAPPED m_overlapped;
+#else
+		int m_file;
+#endif
+	};
+
+	class CMemoryBudget
+	{
+	public:
+		CMemoryBudget() : m_fileName(DefaultBudgetFileName()), m_limitMB(0), m_reservedMB(0), m_peakReservedMB(0), m_waitedMs(0)
+		{
+		}
+
+		// 0 disables the budget.
+		void SetLimit(uint64_t limitBytes)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_limitMB = limitBytes / BytesPerMB;
+		}
+
+		uint64_t GetLimit() const
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_limitMB * BytesPerMB;
+		}
+
+		bool IsEnabled() const
+		{
+			return GetLimit() > 0;
+		}
+
+		// Blocks until 'bytes' fit next to what this and every other instance have reserved.
+		void Acquire(uint64_t bytes)
+		{
+			uint64_t requestedMB = ToMB(bytes);
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (m_limitMB == 0)
+					return;
+
+				if (requestedMB > m_limitMB)
+				{
+					std::string message = "Conversion needs about " + std::to_string(requestedMB) + " MB, which is more than the memory budget of " + std::to_string(m_limitMB) + " MB.";
+					throw std::runtime_error(ErrorMessage(__FUNCTION__, message));
+				}
+			}
+
+			while (TryReserve(requestedMB) == false)
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(PollIntervalMs));
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_waitedMs += PollIntervalMs;
+			}
+		}
+
+		void Release(uint64_t bytes)
+		{
+			uint64_t releasedMB = ToMB(bytes);
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_reservedMB = (releasedMB > m_reservedMB) ? 0 : m_reservedMB - releasedMB;
+
+			CBudgetFile file(m_fileName);
+			std::map<unsigned long, uint64_t> entries = file.Read();
+			if (m_reservedMB > 0)
+				entries[CurrentProcessId()] = m_reservedMB;
+			else
+				entries.erase(CurrentProcessId());
+			file.Write(entries);
+		}
+
+		// Highest total seen across all instances when this one reserved memory.
+		uint64_t GetPeakReserved() const
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_peakReservedMB * BytesPerMB;
+		}
+
+		uint64_t GetTimeWaitedMs() const
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_waitedMs;
+		}
+
+	private:
+		static uint64_t ToMB(uint64_t bytes)
+		{
+			return (bytes + BytesPerMB - 1) / BytesPerMB;
+		}
+
+		bool TryReserve(uint64_t requestedMB)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			CBudgetFile file(m_fileName);
+			std::map<unsigned long, uint64_t> entries = file.Read();
+
+			uint64_t othersMB = 0;
+			std::map<unsigned long, uint64_t>::const_iterator it;
+			for (it = entries.begin(); it != entries.end(); ++it)
+			{
+				if (it->first != CurrentProcessId())
+					othersMB += it->second;
+			}
+
+			if (othersMB + m_reservedMB + requestedMB > m_limitMB)
+				return false;
+
+			m_reservedMB += requestedMB;
+			entries[CurrentProcessId()] = m_reservedMB;
+			file.Write(entries);
+
+			if (othersMB + m_reservedMB > m_peakReservedMB)
+				m_peakReservedMB = othersMB + m_reservedMB;
+			return true;
+		}
+
+		mutable std::mutex m_mutex;
+		std::string m_fileName;
+		uint64_t m_limitMB;
+		uint64_t m_reservedMB;
+		uint64_t m_peakReservedMB;
+		uint64_t m_waitedMs;
+	};
+
+	// Holds a reservation for as long as it is in scope.
+	class CReservation
+	{
+	public:
+		CReservation(CMemoryBudget& budget, uint64_t bytes) : m_budget(budget), m_bytes(0)
+		{
+			if (m_budget.IsEnabled())
+			{
+				m_budget.Acquire(bytes);
+				m_bytes = bytes;
+			}
+		}
+
+		~CReservation()
+		{
+			try
+			{
+				if (m_bytes > 0)
+					m_budget.Release(m_bytes);
+			}
+			catch (...)
+			{
+				// The entry is dropped by the other instances once this process exits.
+			}
+		}
+
+	private:
+		CReservation(const CReservation&);
+		CReservation& operator=(const CReservation&);
+
+		CMemoryBudget& m_budget;
+		uint64_t m_bytes;
+	};
+
+	// Peak resident set size of this process so far, or 0 if it is not available.
+	inline uint64_t PeakResidentSetBytes()
+	{
+#ifdef PYLON_WIN_BUILD
+		PROCESS_MEMORY_COUNTERS counters;
+		if (::GetProcessMemoryInfo(::GetCurrentProcess(), &counters, sizeof(counters)))
+			return static_cast<uint64_t>(counters.PeakWorkingSetSize);
+		return 0;
+#else
+		struct rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) == 0)
+			return static_cast<uint64_t>(usage.ru_maxrss) * 1024ULL; // kilobytes on Linux.
+		return 0;
+#endif
+	}
+}
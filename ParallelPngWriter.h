@@ -0,0 +1,336 @@
+// ParallelPngWriter.h
+// Writes a standards-compliant PNG using all cores for a single frame.
+// The image is split into row groups. Each group is filtered and deflated on its own thread
+// (primed with the previous group's last 32KB as dictionary), and the raw deflate streams are
+// joined with sync flushes into one zlib stream, the same way pigz does it.
+//
+// Copyright (c) 2019 Matthew Breit - matt.breit@baslerweb.com or matt.breit@gmail.com
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http ://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "EncoderUtilities.h"
+#include <zlib.h>
+#include <iostream>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <thread>
+#include <stdint.h>
+
+namespace ParallelPngWriter
+{
+	enum EPngFilter
+	{
+		PngFilter_None = 0,
+		PngFilter_Sub = 1,
+		PngFilter_Up = 2,
+		PngFilter_Average = 3,
+		PngFilter_Paeth = 4,
+		PngFilter_Adaptive = 5 // pick the filter with the smallest sum of absolute differences per row, like libpng.
+	};
+
+	struct SPngOptions
+	{
+		SPngOptions() : compressionLevel(6), filter(PngFilter_Adaptive), threads(0), significantBits(0)
+		{
+		}
+
+		int compressionLevel;  // 0 (store) to 9 (smallest).
+		EPngFilter filter;
+		unsigned int threads;  // 0 uses all hardware threads.
+		uint32_t significantBits; // bits that carry data in MSB aligned samples, e.g. 12 for Mono12 scaled to 16 bit. 0 = all of them.
+	};
+
+	const size_t DictionarySize = 32768;
+	const size_t MinGroupBytes = 256 * 1024; // smaller groups cost compression ratio for no speed gain.
+
+	inline uint8_t PaethPredictor(int a, int b, int c)
+	{
+		int p = a + b - c;
+		int pa = abs(p - a);
+		int pb = abs(p - b);
+		int pc = abs(p - c);
+		if (pa <= pb && pa <= pc)
+			return static_cast<uint8_t>(a);
+		if (pb <= pc)
+			return static_cast<uint8_t>(b);
+		return static_cast<uint8_t>(c);
+	}
+
+	// Filters one row. pPrev is the previous (unfiltered, PNG byte order) row or all zeros for the first row.
+	inline void FilterRow(EPngFilter filter, const uint8_t* pCur, const uint8_t* pPrev, size_t rowBytes, size_t bpp, uint8_t* pOut)
+	{
+		pOut[0] = static_cast<uint8_t>(filter);
+		uint8_t* pDst = pOut + 1;
+
+		switch (filter)
+		{
+			case PngFilter_Sub:
+				for (size_t i = 0; i < bpp; i++)
+					pDst[i] = pCur[i];
+				for (size_t i = bpp; i < rowBytes; i++)
+					pDst[i] = static_cast<uint8_t>(pCur[i] - pCur[i - bpp]);
+				break;
+			case PngFilter_Up:
+				for (size_t i = 0; i < rowBytes; i++)
+					pDst[i] = static_cast<uint8_t>(pCur[i] - pPrev[i]);
+				break;
+			case PngFilter_Average:
+				for (size_t i = 0; i < bpp; i++)
+					pDst[i] = static_cast<uint8_t>(pCur[i] - (pPrev[i] >> 1));
+				for (size_t i = bpp; i < rowBytes; i++)
+					pDst[i] = static_cast<uint8_t>(pCur[i] - ((pCur[i - bpp] + pPrev[i]) >> 1));
+				break;
+			case PngFilter_Paeth:
+				for (size_t i = 0; i < bpp; i++)
+					pDst[i] = static_cast<uint8_t>(pCur[i] - pPrev[i]);
+				for (size_t i = bpp; i < rowBytes; i++)
+					pDst[i] = static_cast<uint8_t>(pCur[i] - PaethPredictor(pCur[i - bpp], pPrev[i], pPrev[i - bpp]));
+				break;
+			default:
+				memcpy(pDst, pCur, rowBytes);
+				break;
+		}
+	}
+
+	inline uint64_t FilterCost(const uint8_t* pFiltered, size_t rowBytes)
+	{
+		uint64_t cost = 0;
+		for (size_t i = 0; i < rowBytes; i++)
+			cost += static_cast<uint64_t>(abs(static_cast<int8_t>(pFiltered[i])));
+		return cost;
+	}
+
+	inline void AppendUInt32(std::vector<char>& out, uint32_t value)
+	{
+		out.push_back(static_cast<char>((value >> 24) & 0xFF));
+		out.push_back(static_cast<char>((value >> 16) & 0xFF));
+		out.push_back(static_cast<char>((value >> 8) & 0xFF));
+		out.push_back(static_cast<char>(value & 0xFF));
+	}
+
+	inline void AppendChunk(std::vector<char>& out, const char* type, const char* pData, size_t size)
+	{
+		AppendUInt32(out, static_cast<uint32_t>(size));
+		size_t typeStart = out.size();
+		out.insert(out.end(), type, type + 4);
+		if (size > 0)
+			out.insert(out.end(), pData, pData + size);
+		uLong crc = crc32(0L, reinterpret_cast<const Bytef*>(&out[typeStart]), static_cast<uInt>(size + 4));
+		AppendUInt32(out, static_cast<uint32_t>(crc));
+	}
+
+	// pPixels: rows of 'channels' interleaved samples of 'bitDepth' (8 or 16, host little endian) bits each.
+	// channels: 1 (gray) or 3 (RGB).
+	inline void Encode(const void* pPixels, uint32_t width, uint32_t height, size_t stride, uint32_t channels, uint32_t bitDepth, const SPngOptions& options, std::vector<char>& png)
+	{
+		std::string errorMessage = "ERROR: ";
+		errorMessage.append(__FUNCTION__);
+		errorMessage.append("(): ");
+
+		if (width == 0 || height == 0)
+			throw std::runtime_error(errorMessage + "Width and Height must be greater than 0.");
+		if (channels != 1 && channels != 3)
+			throw std::runtime_error(errorMessage + "Only gray and RGB images are supported.");
+		if (bitDepth != 8 && bitDepth != 16)
+			throw std::runtime_error(errorMessage + "Only 8 and 16 bit samples are supported.");
+		if (options.compressionLevel < 0 || options.compressionLevel > 9)
+			throw std::runtime_error(errorMessage + "Compression level must be 0 to 9.");
+		if (options.filter < PngFilter_None || options.filter > PngFilter_Adaptive)
+			throw std::runtime_error(errorMessage + "Filter must be 0 to 5.");
+		if (options.significantBits > bitDepth)
+			throw std::runtime_error(errorMessage + "Significant bits must not exceed the bit depth.");
+
+		const size_t bpp = channels * (bitDepth / 8);
+		const size_t rowBytes = static_cast<size_t>(width) * bpp;
+		const size_t filteredRowBytes = rowBytes + 1;
+		if (stride < rowBytes)
+			throw std::runtime_error(errorMessage + "Stride is smaller than a row.");
+
+		unsigned int threads = options.threads;
+		if (threads == 0)
+			threads = std::thread::hardware_concurrency();
+		if (threads == 0)
+			threads = 1;
+
+		// Aim for a few groups per thread, but never so small that the ratio suffers.
+		size_t rowsPerGroup = (height + (threads * 2) - 1) / (threads * 2);
+		size_t minRowsPerGroup = (MinGroupBytes + filteredRowBytes - 1) / filteredRowBytes;
+		if (rowsPerGroup < minRowsPerGroup)
+			rowsPerGroup = minRowsPerGroup;
+		if (rowsPerGroup > height)
+			rowsPerGroup = height;
+		const size_t groupCount = (height + rowsPerGroup - 1) / rowsPerGroup;
+
+		const uint8_t* pSource = static_cast<const uint8_t*>(pPixels);
+		std::vector<uint8_t> filtered(filteredRowBytes * height);
+
+		// Pass 1: filter. Filters only look at unfiltered data, so every group is independent.
+		EncoderUtilities::ParallelFor(groupCount, threads, [&](size_t group)
+		{
+			size_t firstRow = group * rowsPerGroup;
+			size_t lastRow = std::min(firstRow + rowsPerGroup, static_cast<size_t>(height));
+
+			std::vector<uint8_t> previous(rowBytes, 0);
+			std::vector<uint8_t> current(rowBytes);
+			std::vector<uint8_t> candidate(filteredRowBytes);
+
+			// PNG stores 16 bit samples big endian.
+			auto loadRow = [&](size_t row, std::vector<uint8_t>& dst)
+			{
+				const uint8_t* pRow = pSource + row * stride;
+				if (bitDepth == 16)
+				{
+					for (size_t i = 0; i < rowBytes; i += 2)
+					{
+						dst[i] = pRow[i + 1];
+						dst[i + 1] = pRow[i];
+					}
+				}
+				else
+				{
+					memcpy(&dst[0], pRow, rowBytes);
+				}
+			};
+
+			if (firstRow > 0)
+				loadRow(firstRow - 1, previous);
+
+			for (size_t row = firstRow; row < lastRow; row++)
+			{
+				loadRow(row, current);
+				uint8_t* pOut = &filtered[row * filteredRowBytes];
+
+				if (options.filter == PngFilter_Adaptive)
+				{
+					FilterRow(PngFilter_None, &current[0], &previous[0], rowBytes, bpp, pOut);
+					uint64_t bestCost = FilterCost(pOut + 1, rowBytes);
+					for (int f = PngFilter_Sub; f <= PngFilter_Paeth && bestCost > 0; f++)
+					{
+						FilterRow(static_cast<EPngFilter>(f), &current[0], &previous[0], rowBytes, bpp, &candidate[0]);
+						uint64_t cost = FilterCost(&candidate[1], rowBytes);
+						if (cost < bestCost)
+						{
+							bestCost = cost;
+							memcpy(pOut, &candidate[0], filteredRowBytes);
+						}
+					}
+				}
+				else
+				{
+					FilterRow(options.filter, &current[0], &previous[0], rowBytes, bpp, pOut);
+				}
+
+				current.swap(previous);
+			}
+		});
+
+		// Pass 2: deflate each group as a raw stream. All but the last end on a byte boundary with a sync flush.
+		std::vector<std::vector<char> > compressed(groupCount);
+		std::vector<uLong> adlers(groupCount);
+
+		EncoderUtilities::ParallelFor(groupCount, threads, [&](size_t group)
+		{
+			size_t groupStart = group * rowsPerGroup * filteredRowBytes;
+			size_t groupEnd = std::min((group + 1) * rowsPerGroup, static_cast<size_t>(height)) * filteredRowBytes;
+			size_t groupSize = groupEnd - groupStart;
+			bool lastGroup = (group == groupCount - 1);
+
+			adlers[group] = adler32(adler32(0L, Z_NULL, 0), &filtered[groupStart], static_cast<uInt>(groupSize));
+
+			z_stream stream;
+			memset(&stream, 0, sizeof(stream));
+			if (deflateInit2(&stream, options.compressionLevel, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+				throw std::runtime_error(errorMessage + "deflateInit2 failed.");
+
+			if (group > 0)
+			{
+				size_t dictionarySize = std::min(DictionarySize, groupStart);
+				deflateSetDictionary(&stream, &filtered[groupStart - dictionarySize], static_cast<uInt>(dictionarySize));
+			}
+
+			std::vector<char>& out = compressed[group];
+			size_t headerBytes = (group == 0) ? 2 : 0;
+			out.resize(headerBytes + deflateBound(&stream, static_cast<uLong>(groupSize)) + 16);
+
+			stream.next_in = &filtered[groupStart];
+			stream.avail_in = static_cast<uInt>(groupSize);
+			stream.next_out = reinterpret_cast<Bytef*>(&out[headerBytes]);
+			stream.avail_out = static_cast<uInt>(out.size() - headerBytes);
+
+			int result = deflate(&stream, lastGroup ? Z_FINISH : Z_SYNC_FLUSH);
+			bool complete = lastGroup ? (result == Z_STREAM_END) : (result == Z_OK && stream.avail_in == 0 && stream.avail_out > 0);
+			out.resize(out.size() - stream.avail_out);
+			deflateEnd(&stream);
+
+			if (complete == false)
+				throw std::runtime_error(errorMessage + "deflate failed.");
+		});
+
+		// zlib header (CMF, FLG with the level hint) goes in front of the first group, Adler-32 after the last.
+		unsigned int levelHint = (options.compressionLevel < 2) ? 0 : (options.compressionLevel < 6) ? 1 : (options.compressionLevel == 6) ? 2 : 3;
+		unsigned int cmf = 0x78;
+		unsigned int flg = levelHint << 6;
+		flg += 31 - ((cmf * 256 + flg) % 31);
+		compressed[0][0] = static_cast<char>(cmf);
+		compressed[0][1] = static_cast<char>(flg);
+
+		uLong adler = adlers[0];
+		for (size_t group = 1; group < groupCount; group++)
+		{
+			size_t groupRows = std::min((group + 1) * rowsPerGroup, static_cast<size_t>(height)) - group * rowsPerGroup;
+			adler = adler32_combine(adler, adlers[group], static_cast<z_off_t>(groupRows * filteredRowBytes));
+		}
+		AppendUInt32(compressed[groupCount - 1], static_cast<uint32_t>(adler));
+
+		// Assemble the file.
+		static const char signature[8] = { '\x89', 'P', 'N', 'G', '\r', '\n', '\x1A', '\n' };
+		size_t totalSize = sizeof(signature) + 25 + 15 + 12;
+		for (size_t group = 0; group < groupCount; group++)
+			totalSize += compressed[group].size() + 12;
+
+		png.clear();
+		png.reserve(totalSize);
+		png.insert(png.end(), signature, signature + sizeof(signature));
+
+		std::vector<char> header;
+		AppendUInt32(header, width);
+		AppendUInt32(header, height);
+		header.push_back(static_cast<char>(bitDepth));
+		header.push_back(static_cast<char>(channels == 1 ? 0 : 2)); // color type: gray or truecolor
+		header.push_back(0); // compression method: deflate
+		header.push_back(0); // filter method: adaptive
+		header.push_back(0); // interlace: none
+		AppendChunk(png, "IHDR", &header[0], header.size());
+
+		// sBIT lets readers shift MSB aligned 10 or 12 bit samples back to their original values.
+		if (options.significantBits > 0 && options.significantBits < bitDepth)
+		{
+			std::vector<char> significantBits(channels, static_cast<char>(options.significantBits));
+			AppendChunk(png, "sBIT", &significantBits[0], significantBits.size());
+		}
+
+		for (size_t group = 0; group < groupCount; group++)
+		{
+			AppendChunk(png, "IDAT", &compressed[group][0], compressed[group].size());
+			std::vector<char>().swap(compressed[group]);
+		}
+
+		AppendChunk(png, "IEND", NULL, 0);
+	}
+}
@@ -17,14 +17,25 @@
 //
 
 #include "LoadPylonRawFile.h"
+#include "TarArchiveWriter.h"
+#include "ParallelPngWriter.h"
+#include "TiffWriter.h"
+#include "FrameDeduplicator.h"
+#include "FrameStatistics.h"
+#include "MemoryBudget.h"
 
 // Include files to use the PYLON API.
 #include <pylon/PylonIncludes.h>
 #include <iostream>
 #include <fstream>
 #include <stdexcept>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
 #ifndef PYLON_WIN_BUILD
 #include <dirent.h> // For Listing all files in a directory in Linux.
+#include <unistd.h> // For getpid() when naming the scratch file.
 #endif
 
 using namespace Pylon;
@@ -38,9 +49,19 @@ using namespace std;
 #define PARSE_PREFIX_DEFAULT "parseme"
 #define PARSE_NUM_FIELDS 6
 #define VERSION_NUMBER "v19.02-1 (BETA)"
+#define ARCHIVE_SIZE_MB_DEFAULT 1024
 
 bool pauseBeforeExit = true;
 bool silent = false;
+TarArchiveWriter::CTarArchiveWriter archiveWriter;
+ParallelPngWriter::SPngOptions pngOptions;
+TiffWriter::STiffOptions tiffOptions;
+FrameDeduplicator::CFrameDeduplicator deduplicator;
+FrameStatistics::CStatisticsReport statisticsReport;
+FrameStatistics::SThresholds qaThresholds;
+bool qaSkipFlagged = false;
+bool lsbAligned = false;
+MemoryBudget::CMemoryBudget memoryBudget;
 
 Pylon::PixelType PixelTypeFromInt(int pixelTypeID)
 {
@@ -104,8 +125,197 @@ Pylon::EImageFileFormat FileFormatFromInt(int fileFormatID)
 
 
 
-bool RawFileConverter(std::string fileName, uint32_t imageWidth, uint32_t imageHeight, Pylon::EPixelType imagePixelFormat, Pylon::EImageFileFormat destinationFileFormat)
+// Pylon can only save to a file, so archive mode encodes into one reused scratch file on local temp storage
+// and streams the result into the archive. This keeps the file-create storm off the destination file system.
+std::string ScratchFileName(const std::string& extension)
 {
+	std::string tempDirectory;
+#ifdef PYLON_WIN_BUILD
+	char tempPath[MAX_PATH];
+	if (::GetTempPathA(MAX_PATH, tempPath) > 0)
+		tempDirectory = tempPath;
+	unsigned long processId = ::GetCurrentProcessId();
+#else
+	const char* pTempDir = getenv("TMPDIR");
+	tempDirectory = (pTempDir != NULL) ? pTempDir : "/tmp";
+	tempDirectory.append("/");
+	unsigned long processId = static_cast<unsigned long>(getpid());
+#endif
+	return tempDirectory + "PylonRawFileConverter_" + std::to_string(processId) + ".scratch" + extension;
+}
+
+void EncodeToBuffer(Pylon::EImageFileFormat destinationFileFormat, const std::string& extension, const Pylon::CPylonImage& image, std::vector<char>& encoded)
+{
+	std::string scratchFileName = ScratchFileName(extension);
+
+	Pylon::CImagePersistence::Save(destinationFileFormat, scratchFileName.c_str(), image);
+
+	std::ifstream scratchFile(scratchFileName.c_str(), std::ifstream::binary);
+	if (!scratchFile)
+		throw std::runtime_error("Could not open scratch file: " + scratchFileName);
+
+	scratchFile.seekg(0, scratchFile.end);
+	std::streamoff scratchSize = scratchFile.tellg();
+	scratchFile.seekg(0, scratchFile.beg);
+
+	encoded.resize(static_cast<size_t>(scratchSize));
+	if (scratchSize > 0)
+		scratchFile.read(&encoded[0], scratchSize);
+
+	bool readOk = !scratchFile.fail();
+	scratchFile.close();
+	std::remove(scratchFileName.c_str());
+
+	if (readOk == false)
+		throw std::runtime_error("Could not read scratch file: " + scratchFileName);
+}
+
+// The native encoders take 8 or 16 bit gray or RGB samples. Anything else (Bayer, BGR, YUV) goes through the pylon converter.
+// 10 and 12 bit data is written MSB aligned, i.e. scaled to the full 16 bit range, whether it is mono or color.
+// significantBits tells the PNG writer how many of those bits carry data. With --lsbaligned the values are kept unscaled instead.
+const Pylon::CPylonImage& PrepareImageForEncoding(const Pylon::CPylonImage& sourceImage, Pylon::CPylonImage& convertedImage, uint32_t& channels, uint32_t& bitDepth, uint32_t& significantBits)
+{
+	Pylon::EPixelType sourcePixelType = sourceImage.GetPixelType();
+	significantBits = 0;
+
+	bool isUnpackedMono = Pylon::IsMonoImage(sourcePixelType) && (Pylon::BitPerPixel(sourcePixelType) == 8 || Pylon::BitPerPixel(sourcePixelType) == 16);
+	if (isUnpackedMono && (Pylon::BitDepth(sourcePixelType) == Pylon::BitPerPixel(sourcePixelType) || lsbAligned == true))
+	{
+		channels = 1;
+		bitDepth = Pylon::BitPerPixel(sourcePixelType);
+		return sourceImage;
+	}
+
+	if (sourcePixelType == Pylon::EPixelType::PixelType_RGB8packed)
+	{
+		channels = 3;
+		bitDepth = 8;
+		return sourceImage;
+	}
+
+	// Unpacked Mono10/Mono12: shift up to MSB alignment, the same as the converter does for the color types below.
+	if (isUnpackedMono)
+	{
+		const uint32_t width = sourceImage.GetWidth();
+		const uint32_t height = sourceImage.GetHeight();
+		const uint32_t shift = 16 - Pylon::BitDepth(sourcePixelType);
+
+		size_t sourceStride = 0;
+		if (sourceImage.GetStride(sourceStride) == false)
+			sourceStride = static_cast<size_t>(width) * 2;
+
+		convertedImage.Reset(Pylon::EPixelType::PixelType_Mono16, width, height);
+		const uint8_t* pSource = static_cast<const uint8_t*>(sourceImage.GetBuffer());
+		uint16_t* pTarget = static_cast<uint16_t*>(convertedImage.GetBuffer());
+		for (uint32_t y = 0; y < height; y++)
+		{
+			const uint16_t* pSourceRow = reinterpret_cast<const uint16_t*>(pSource + y * sourceStride);
+			uint16_t* pTargetRow = pTarget + static_cast<size_t>(y) * width;
+			for (uint32_t x = 0; x < width; x++)
+				pTargetRow[x] = static_cast<uint16_t>(pSourceRow[x] << shift);
+		}
+
+		channels = 1;
+		bitDepth = 16;
+		significantBits = Pylon::BitDepth(sourcePixelType);
+		return convertedImage;
+	}
+
+	bool highBitDepth = (Pylon::BitDepth(sourcePixelType) > 8);
+	Pylon::CImageFormatConverter converter;
+	converter.OutputBitAlignment.SetValue(lsbAligned ? Pylon::OutputBitAlignment_LsbAligned : Pylon::OutputBitAlignment_MsbAligned);
+	if (highBitDepth == true && lsbAligned == false)
+		significantBits = Pylon::BitDepth(sourcePixelType);
+	if (Pylon::IsMonoImage(sourcePixelType))
+	{
+		channels = 1;
+		converter.OutputPixelFormat.SetValue(highBitDepth ? Pylon::EPixelType::PixelType_Mono16 : Pylon::EPixelType::PixelType_Mono8);
+	}
+	else
+	{
+		channels = 3;
+		converter.OutputPixelFormat.SetValue(highBitDepth ? Pylon::EPixelType::PixelType_RGB16packed : Pylon::EPixelType::PixelType_RGB8packed);
+	}
+	bitDepth = highBitDepth ? 16 : 8;
+
+	converter.Convert(convertedImage, sourceImage);
+	return convertedImage;
+}
+
+// Encodes with one of our own writers if there is one for this format. Returns false to fall back to CImagePersistence.
+bool EncodeNative(Pylon::EImageFileFormat destinationFileFormat, const Pylon::CPylonImage& image, std::vector<char>& encoded)
+{
+	if (destinationFileFormat != ImageFileFormat_Png && destinationFileFormat != ImageFileFormat_Tiff)
+		return false;
+
+	Pylon::CPylonImage convertedImage;
+	uint32_t channels = 0;
+	uint32_t bitDepth = 0;
+	uint32_t significantBits = 0;
+	const Pylon::CPylonImage& encodeImage = PrepareImageForEncoding(image, convertedImage, channels, bitDepth, significantBits);
+
+	size_t stride = 0;
+	if (encodeImage.GetStride(stride) == false)
+		stride = static_cast<size_t>(encodeImage.GetWidth()) * channels * (bitDepth / 8);
+
+	if (destinationFileFormat == ImageFileFormat_Tiff)
+		TiffWriter::Encode(encodeImage.GetBuffer(), encodeImage.GetWidth(), encodeImage.GetHeight(), stride, channels, bitDepth, tiffOptions, encoded);
+	else
+	{
+		ParallelPngWriter::SPngOptions frameOptions = pngOptions;
+		frameOptions.significantBits = significantBits;
+		ParallelPngWriter::Encode(encodeImage.GetBuffer(), encodeImage.GetWidth(), encodeImage.GetHeight(), stride, channels, bitDepth, frameOptions, encoded);
+	}
+	return true;
+}
+
+// Peak memory of one conversion, worked out from geometry and pixel type before anything is loaded.
+uint64_t EstimatePeakFootprint(uint32_t imageWidth, uint32_t imageHeight, Pylon::EPixelType imagePixelFormat, Pylon::EImageFileFormat destinationFileFormat)
+{
+	const uint64_t pixels = static_cast<uint64_t>(imageWidth) * imageHeight;
+
+	// Load() holds its read buffer and the CPylonImage copy at the same time.
+	const uint64_t rawBytes = pixels * Pylon::BitPerPixel(imagePixelFormat) / 8;
+	const uint64_t loadPeak = rawBytes * 2;
+
+	// The native encoders work on the loaded image or on a converted copy, see PrepareImageForEncoding().
+	const bool isMono = Pylon::IsMonoImage(imagePixelFormat);
+	const uint64_t encodeBytes = pixels * (isMono ? 1 : 3) * ((Pylon::BitDepth(imagePixelFormat) > 8) ? 2 : 1);
+	const bool needsConversion = !(isMono && (Pylon::BitPerPixel(imagePixelFormat) == 8 || Pylon::BitDepth(imagePixelFormat) == 16 || (lsbAligned && Pylon::BitPerPixel(imagePixelFormat) == 16)))
+		&& imagePixelFormat != Pylon::EPixelType::PixelType_RGB8packed;
+
+	uint64_t encoderBytes = 0;
+	switch (destinationFileFormat)
+	{
+		case ImageFileFormat_Png:
+			// filtered copy + compressed row groups + assembled file
+			encoderBytes = (needsConversion ? encodeBytes : 0) + encodeBytes * 3;
+			break;
+		case ImageFileFormat_Tiff:
+			// compressed strips + assembled file
+			encoderBytes = (needsConversion ? encodeBytes : 0) + encodeBytes * 2;
+			break;
+		default:
+			// CImagePersistence converts to RGB internally; archive mode also reads the result back.
+			encoderBytes = pixels * 3 * ((archiveWriter.IsOpen() == true) ? 3 : 2);
+			break;
+	}
+
+	// --dedup keeps a copy of the most recent unique frame.
+	const uint64_t dedupBytes = deduplicator.IsEnabled() ? rawBytes : 0;
+
+	uint64_t statisticsBytes = 0;
+	if (statisticsReport.IsOpen() == true || qaThresholds.IsEnabled() == true)
+		statisticsBytes = 4ULL * 65536 * FrameStatistics::SubHistograms * sizeof(uint32_t);
+
+	return std::max(loadPeak, rawBytes + encoderBytes + statisticsBytes) + dedupBytes;
+}
+
+// frameSkipped is set when --qaskip left a flagged frame unconverted. That still counts as success.
+bool RawFileConverter(std::string fileName, uint32_t imageWidth, uint32_t imageHeight, Pylon::EPixelType imagePixelFormat, Pylon::EImageFileFormat destinationFileFormat, bool& frameSkipped)
+{
+	frameSkipped = false;
+
 	try
 	{
 		std::string extension = "";
@@ -148,6 +358,13 @@ bool RawFileConverter(std::string fileName, uint32_t imageWidth, uint32_t imageH
 		if (imageHeight == 0)
 			throw std::runtime_error("Height must be greater than 0.");
 
+		// Waits here until the frame fits in the budget shared with other instances, or throws if it never can.
+		// Released when the conversion returns.
+		uint64_t waitedMsBefore = memoryBudget.GetTimeWaitedMs();
+		MemoryBudget::CReservation reservation(memoryBudget, EstimatePeakFootprint(imageWidth, imageHeight, imagePixelFormat, destinationFileFormat));
+		if (memoryBudget.GetTimeWaitedMs() > waitedMsBefore && silent == false)
+			std::cout << "Waited " << (memoryBudget.GetTimeWaitedMs() - waitedMsBefore) << " ms for the memory budget." << std::endl;
+
 		Pylon::CPylonImage tempImage;
 
 		LoadPylonRawFile::Load(fileName.c_str(), tempImage, imageWidth, imageHeight, imagePixelFormat);
@@ -162,13 +379,96 @@ bool RawFileConverter(std::string fileName, uint32_t imageWidth, uint32_t imageH
 
 		newFileName.append(extension);
 
+		// Statistics come from the raw buffer while it is still in cache, so QA doesn't have to re-read the output.
+		if ((statisticsReport.IsOpen() == true || qaThresholds.IsEnabled() == true) && tempImage.IsValid() == true)
+		{
+			FrameStatistics::SFrameStatistics statistics;
+			statistics.fileName = fileName;
+			statistics.pixelTypeName = Pylon::CPixelTypeMapper::GetNameByPixelType(imagePixelFormat);
+
+			size_t stride = 0;
+			if (tempImage.GetStride(stride) == false)
+				stride = tempImage.GetImageSize() / imageHeight;
+
+			FrameStatistics::Compute(tempImage.GetBuffer(), imageWidth, imageHeight, stride, FrameStatistics::LayoutFromPixelType(imagePixelFormat), statistics);
+			FrameStatistics::Evaluate(statistics, qaThresholds);
+			statisticsReport.Write(statistics);
+
+			if (statistics.flagged == true)
+			{
+				if (silent == false)
+				{
+					std::cout << "Frame flagged by QA thresholds: " << fileName << std::endl;
+					for (size_t i = 0; i < statistics.flagReasons.size(); i++)
+						std::cout << "  " << statistics.flagReasons[i] << std::endl;
+				}
+
+				if (qaSkipFlagged == true)
+				{
+					frameSkipped = true;
+					return true;
+				}
+			}
+		}
+
+		// Identical raw data with identical settings gives identical output, so reuse the first one.
+		uint64_t frameHash = 0;
+		std::string conversionKey = "";
+		if (deduplicator.IsEnabled() == true && tempImage.IsValid() == true)
+		{
+			frameHash = FrameDeduplicator::HashBuffer(tempImage.GetBuffer(), tempImage.GetImageSize());
+			conversionKey = std::to_string(imageWidth) + "x" + std::to_string(imageHeight) + "_" + std::to_string(imagePixelFormat) + extension
+				+ "_l" + std::to_string(pngOptions.compressionLevel) + "_f" + std::to_string(pngOptions.filter)
+				+ "_c" + std::to_string(tiffOptions.compression) + "_p" + std::to_string(tiffOptions.predictor) + "_d" + std::to_string(tiffOptions.deflateLevel);
+
+			std::string existingFileName = "";
+			if (deduplicator.FindDuplicate(frameHash, conversionKey, tempImage.GetBuffer(), tempImage.GetImageSize(), existingFileName) == true)
+			{
+				std::string action = "referenced in archive as";
+				if (archiveWriter.IsOpen() == true)
+					archiveWriter.AddReference(newFileName, existingFileName);
+				else if (FrameDeduplicator::LinkOrCopyFile(existingFileName, newFileName) == true)
+					action = "linked as";
+				else
+					action = "copied to";
+
+				deduplicator.RecordDuplicate(existingFileName, newFileName, tempImage.GetImageSize());
+
+				if (silent == false)
+					std::cout << "Duplicate of " << existingFileName << ", " << action << ": " << newFileName << std::endl;
+
+				return true;
+			}
+		}
+
 		if (silent == false)
 			std::cout << "Converting and Saving Image..." << std::endl;
 
-		Pylon::CImagePersistence::Save(destinationFileFormat, newFileName.c_str(), tempImage);
+		std::vector<char> encoded;
+		bool encodedNatively = EncodeNative(destinationFileFormat, tempImage, encoded);
 
-		if (silent == false)
-			std::cout << "Image saved as: " << newFileName << std::endl;
+		if (archiveWriter.IsOpen() == true)
+		{
+			if (encodedNatively == false)
+				EncodeToBuffer(destinationFileFormat, extension, tempImage, encoded);
+			archiveWriter.AddFile(newFileName, encoded.empty() ? NULL : &encoded[0], encoded.size());
+
+			if (silent == false)
+				std::cout << "Image archived as: " << newFileName << " in " << archiveWriter.CurrentArchiveName() << std::endl;
+		}
+		else
+		{
+			if (encodedNatively == true)
+				EncoderUtilities::WriteFile(newFileName, encoded);
+			else
+				Pylon::CImagePersistence::Save(destinationFileFormat, newFileName.c_str(), tempImage);
+
+			if (silent == false)
+				std::cout << "Image saved as: " << newFileName << std::endl;
+		}
+
+		if (deduplicator.IsEnabled() == true && tempImage.IsValid() == true)
+			deduplicator.RecordConverted(frameHash, conversionKey, tempImage.GetBuffer(), tempImage.GetImageSize(), fileName, newFileName);
 
 		return true;
 	}
@@ -217,6 +517,23 @@ void PrintHelpMenu()
 	std::cout << "      --parse (parse a raw image's file name to determine properties. File name must follow the style below...)" << std::endl;
 	std::cout << "      --parseprefix (specify your own filename prefix for parsing. Default: \"" << PARSE_PREFIX_DEFAULT << "\")" << std::endl;
 	std::cout << "      --silent (suppress all console output except error messages)" << std::endl;
+	std::cout << "      --archive (write all converted images into rolling tar archives with this base name, plus a .index file)" << std::endl;
+	std::cout << "      --archivesize (maximum size of each archive in MB before rolling over. Default: " << ARCHIVE_SIZE_MB_DEFAULT << ")" << std::endl;
+	std::cout << "      --threads (number of threads used to encode a single PNG or TIFF image. Default: 0 = all cores)" << std::endl;
+	std::cout << "      --pnglevel (PNG compression level, 0 = fastest to 9 = smallest. Default: 6)" << std::endl;
+	std::cout << "      --pngfilter (PNG row filter, 0 = None, 1 = Sub, 2 = Up, 3 = Average, 4 = Paeth, 5 = Adaptive. Default: 5)" << std::endl;
+	std::cout << "      --tiffcompression (TIFF compression, 0 = None, 1 = PackBits, 2 = LZW, 3 = Deflate. Default: 0)" << std::endl;
+	std::cout << "      --tiffpredictor (use the horizontal predictor with LZW and Deflate, 0 = off, 1 = on. Default: 1)" << std::endl;
+	std::cout << "      --tifflevel (TIFF Deflate level, 1 = fastest to 9 = smallest. Default: 6)" << std::endl;
+	std::cout << "      --lsbaligned (keep 10 and 12 bit pixel values unscaled in PNG and TIFF files, as earlier versions wrote them)" << std::endl;
+	std::cout << "      --dedup (hardlink frames whose raw data matches an already converted frame instead of encoding them again)" << std::endl;
+	std::cout << "      --stats (write per-channel statistics of every frame to this file. JSON Lines, or CSV if the name ends in .csv)" << std::endl;
+	std::cout << "      --qamaxsaturated (flag frames with more than this percent of saturated pixels in any channel)" << std::endl;
+	std::cout << "      --qamaxdead (flag frames with more than this percent of zero pixels in any channel)" << std::endl;
+	std::cout << "      --qaminmean (flag frames whose mean in any channel is below this percent of full scale)" << std::endl;
+	std::cout << "      --qamaxmean (flag frames whose mean in any channel is above this percent of full scale)" << std::endl;
+	std::cout << "      --qaskip (do not convert flagged frames)" << std::endl;
+	std::cout << "      --max-memory (memory budget in MB, shared by all instances on this machine. Frames wait until their estimated peak memory fits, larger frames are rejected. Default: 0 = no limit)" << std::endl;
 	std::cout << " 3. Drag-n-Drop: On Windows, simply drag and drop a parseable raw image with default prefix file onto the icon." << std::endl;
 	std::cout << endl;
 	std::cout << "Examples:" << std::endl;
@@ -233,6 +550,20 @@ void PrintHelpMenu()
 	std::cout << " 4. Parse and convert a batch of files: (convert all files in current directory that have a parseable file name.)" << std::endl;
 	std::cout << "     PylonRawFileConverter.exe --batch --parse" << std::endl;
 	std::cout << "     PylonRawFileConverter.exe --batch --parse --parseprefix myPrefix" << std::endl;
+	std::cout << " 5. Convert a batch of files into archives instead of individual files:" << std::endl;
+	std::cout << "     PylonRawFileConverter.exe --batch --parse --archive converted --archivesize 4096" << std::endl;
+	std::cout << "     (creates converted_0000.tar, converted_0001.tar, ... and converted.index listing archive, offset, size, name of each image)" << std::endl;
+	std::cout << " 6. Convert a batch of files and skip encoding frames that are identical to one already converted:" << std::endl;
+	std::cout << "     PylonRawFileConverter.exe --batch --parse --dedup" << std::endl;
+	std::cout << " 7. Convert a batch of files, record statistics and skip frames that are mostly black or saturated:" << std::endl;
+	std::cout << "     PylonRawFileConverter.exe --batch --parse --stats stats.csv --qamaxsaturated 5 --qaminmean 2 --qaskip" << std::endl;
+	std::cout << " 8. Convert a batch of 12 bit images to 16 bit TIFF files with LZW compression:" << std::endl;
+	std::cout << "     PylonRawFileConverter.exe --batch --width 640 --height 480 --pixeltype 3 --fileformat 1 --tiffcompression 2" << std::endl;
+	std::cout << "     (10 and 12 bit pixel values are shifted up to the full 16 bit range (MSB aligned) in PNG and TIFF files," << std::endl;
+	std::cout << "     e.g. Mono12 4095 becomes 65520. Bayer images are converted to RGB first.)" << std::endl;
+	std::cout << " 9. Convert a batch of files without using more than 2 GB of memory, even with several instances running:" << std::endl;
+	std::cout << "     PylonRawFileConverter.exe --batch --parse --max-memory 2048" << std::endl;
+	std::cout << "     (instances share the budget through a file in the temp directory, so start them all with the same --max-memory)" << std::endl;
 	std::cout << std::endl;
 	std::cout << "Pixel Type List: " << std::endl;
 	std::cout << " 1 : PixelType_Mono8" << std::endl;
@@ -345,6 +676,9 @@ int main(int argc, char* argv[])
 		uint32_t rawHeight = NO_HEIGHT_GIVEN;
 		int rawPixelType_int = NO_PIXELTYPE_GIVEN;
 		int newFileFormat_int = NO_FILEFORMAT_GIVEN;
+		string archiveBaseName = NO_FILENAME_GIVEN;
+		string statisticsFileName = NO_FILENAME_GIVEN;
+		uint64_t archiveSizeMB = ARCHIVE_SIZE_MB_DEFAULT;
 		Pylon::EPixelType rawPixelType;
 		Pylon::EImageFileFormat newFileFormat;
 
@@ -415,6 +749,83 @@ int main(int argc, char* argv[])
 						silent = true;
 						pauseBeforeExit = false;
 					}
+					else if (string(argv[i]) == "--archive")
+					{
+						archiveBaseName = string(argv[i + 1]);
+					}
+					else if (string(argv[i]) == "--archivesize")
+					{
+						std::string::size_type sz;
+						archiveSizeMB = stoull(string(argv[i + 1]), &sz, 10);
+					}
+					else if (string(argv[i]) == "--tiffcompression")
+					{
+						std::string::size_type sz;
+						tiffOptions.compression = (TiffWriter::ETiffCompression)stoi(string(argv[i + 1]), &sz, 10);
+					}
+					else if (string(argv[i]) == "--tiffpredictor")
+					{
+						std::string::size_type sz;
+						tiffOptions.predictor = (stoi(string(argv[i + 1]), &sz, 10) != 0);
+					}
+					else if (string(argv[i]) == "--tifflevel")
+					{
+						std::string::size_type sz;
+						tiffOptions.deflateLevel = stoi(string(argv[i + 1]), &sz, 10);
+					}
+					else if (string(argv[i]) == "--max-memory")
+					{
+						std::string::size_type sz;
+						memoryBudget.SetLimit(stoull(string(argv[i + 1]), &sz, 10) * MemoryBudget::BytesPerMB);
+					}
+					else if (string(argv[i]) == "--lsbaligned")
+					{
+						lsbAligned = true;
+					}
+					else if (string(argv[i]) == "--dedup")
+					{
+						deduplicator.Enable(true);
+					}
+					else if (string(argv[i]) == "--stats")
+					{
+						statisticsFileName = string(argv[i + 1]);
+					}
+					else if (string(argv[i]) == "--qamaxsaturated")
+					{
+						qaThresholds.maxSaturatedPercent = stod(string(argv[i + 1]));
+					}
+					else if (string(argv[i]) == "--qamaxdead")
+					{
+						qaThresholds.maxDeadPercent = stod(string(argv[i + 1]));
+					}
+					else if (string(argv[i]) == "--qaminmean")
+					{
+						qaThresholds.minMeanPercent = stod(string(argv[i + 1]));
+					}
+					else if (string(argv[i]) == "--qamaxmean")
+					{
+						qaThresholds.maxMeanPercent = stod(string(argv[i + 1]));
+					}
+					else if (string(argv[i]) == "--qaskip")
+					{
+						qaSkipFlagged = true;
+					}
+					else if (string(argv[i]) == "--threads")
+					{
+						std::string::size_type sz;
+						pngOptions.threads = stoi(string(argv[i + 1]), &sz, 10);
+						tiffOptions.threads = pngOptions.threads;
+					}
+					else if (string(argv[i]) == "--pnglevel")
+					{
+						std::string::size_type sz;
+						pngOptions.compressionLevel = stoi(string(argv[i + 1]), &sz, 10);
+					}
+					else if (string(argv[i]) == "--pngfilter")
+					{
+						std::string::size_type sz;
+						pngOptions.filter = (ParallelPngWriter::EPngFilter)stoi(string(argv[i + 1]), &sz, 10);
+					}
 					else
 					{
 						cout << endl << "INVALID OPTION: " << argument << endl;
@@ -510,6 +921,20 @@ int main(int argc, char* argv[])
 			}
 		}
 
+		if (archiveBaseName != NO_FILENAME_GIVEN)
+		{
+			archiveWriter.Open(archiveBaseName, archiveSizeMB * 1024ULL * 1024ULL);
+			if (silent == false)
+				std::cout << "Archiving converted images to: " << archiveBaseName << "_*.tar (index: " << archiveBaseName << ".index)" << std::endl;
+		}
+
+		if (statisticsFileName != NO_FILENAME_GIVEN)
+		{
+			statisticsReport.Open(statisticsFileName);
+			if (silent == false)
+				std::cout << "Writing frame statistics to: " << statisticsFileName << std::endl;
+		}
+
 		if (batchMode == false)
 		{
 			if (silent == false)
@@ -527,8 +952,12 @@ int main(int argc, char* argv[])
 			rawPixelType = PixelTypeFromInt(rawPixelType_int);
 			newFileFormat = FileFormatFromInt(newFileFormat_int);
 
-			if (RawFileConverter(rawFileName, rawWidth, rawHeight, rawPixelType, newFileFormat) == false)
+			bool frameSkipped = false;
+			if (RawFileConverter(rawFileName, rawWidth, rawHeight, rawPixelType, newFileFormat, frameSkipped) == false)
 				throw std::runtime_error("RawFileConverter() failed.");
+
+			if (frameSkipped == true && silent == false)
+				std::cout << "Skipped File (flagged by QA): " << rawFileName << "..." << std::endl;
 		}
 		else
 		{
@@ -603,12 +1032,16 @@ int main(int argc, char* argv[])
 				// if the file is raw and we have the info, try converting it.
 				if (isRaw == true && hasInfo == true)
 				{
-					if (RawFileConverter(rawFileName, rawWidth, rawHeight, rawPixelType, newFileFormat) == true)
+					bool frameSkipped = false;
+					if (RawFileConverter(rawFileName, rawWidth, rawHeight, rawPixelType, newFileFormat, frameSkipped) == true)
 					{
 						if (silent == false)
 						{
 							std::cout << std::endl;
-							std::cout << "Converted File: " << rawFileName << "..." << std::endl;
+							if (frameSkipped == true)
+								std::cout << "Skipped File (flagged by QA): " << rawFileName << "..." << std::endl;
+							else
+								std::cout << "Converted File: " << rawFileName << "..." << std::endl;
 						}
 					}
 					else
@@ -627,6 +1060,12 @@ int main(int argc, char* argv[])
 				}
 			}
 		}
+
+		archiveWriter.Close();
+		statisticsReport.Close();
+
+		if (deduplicator.IsEnabled() == true && silent == false)
+			deduplicator.PrintSummary(std::cout);
 	}
 	catch (GenICam::GenericException &e)
 	{
@@ -650,6 +1089,21 @@ int main(int argc, char* argv[])
 		pauseBeforeExit = true;
 	}
 
+	if (memoryBudget.IsEnabled() == true)
+	{
+		uint64_t peakRss = MemoryBudget::PeakResidentSetBytes();
+		if (silent == false)
+		{
+			std::cout << std::endl;
+			std::cout << "Memory Budget : " << memoryBudget.GetLimit() / MemoryBudget::BytesPerMB << " MB" << std::endl;
+			std::cout << "Peak Reserved : " << memoryBudget.GetPeakReserved() / MemoryBudget::BytesPerMB << " MB (all instances)" << std::endl;
+			std::cout << "Time Waited   : " << memoryBudget.GetTimeWaitedMs() / 1000 << " s" << std::endl;
+			std::cout << "Peak RSS      : " << peakRss / MemoryBudget::BytesPerMB << " MB" << std::endl;
+		}
+		if (peakRss > memoryBudget.GetLimit())
+			std::cerr << "WARNING: Peak RSS of " << peakRss / MemoryBudget::BytesPerMB << " MB exceeded the memory budget of " << memoryBudget.GetLimit() / MemoryBudget::BytesPerMB << " MB." << std::endl;
+	}
+
 	// Comment the following two lines to disable waiting on exit.
 	if (pauseBeforeExit == true)
 	{
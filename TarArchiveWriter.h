@@ -0,0 +1,299 @@
+// TarArchiveWriter.h
+// Streams converted images into one or more rolling tar archives instead of individual files.
+// An index file records where every member's data starts, so any single frame can be
+// extracted with one seek: dd if=<archive> bs=1 skip=<offset> count=<size>
+// Names longer than the 100 character ustar name field get a pax extended header with the full path.
+//
+// Copyright (c) 2019 Matthew Breit - matt.breit@baslerweb.com or matt.breit@gmail.com
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http ://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <iostream>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <map>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <ctime>
+#include <stdint.h>
+
+namespace TarArchiveWriter
+{
+	const uint64_t TarBlockSize = 512;
+	const uint64_t DefaultArchiveSize = 1024ULL * 1024ULL * 1024ULL; // 1 GiB per archive before rolling over.
+
+	class CTarArchiveWriter
+	{
+	public:
+		CTarArchiveWriter() : m_maxArchiveSize(DefaultArchiveSize), m_archiveNumber(0), m_archiveSize(0), m_isOpen(false)
+		{
+		}
+
+		~CTarArchiveWriter()
+		{
+			try
+			{
+				Close();
+			}
+			catch (...)
+			{
+			}
+		}
+
+		// baseName "output" produces output_0000.tar, output_0001.tar, ... and output.index
+		void Open(const std::string& baseName, uint64_t maxArchiveSize)
+		{
+			Close();
+
+			m_baseName = baseName;
+			m_maxArchiveSize = (maxArchiveSize < TarBlockSize * 4) ? TarBlockSize * 4 : maxArchiveSize;
+			m_archiveNumber = 0;
+			m_members.clear();
+
+			std::string indexName = m_baseName + ".index";
+			m_indexFile.open(indexName.c_str(), std::ofstream::out | std::ofstream::trunc);
+			if (!m_indexFile)
+				throw std::runtime_error(ErrorMessage(__FUNCTION__, "Index file could not be created: " + indexName));
+
+			m_indexFile << "# archive\toffset\tsize\tname" << std::endl;
+
+			OpenNextArchive();
+			m_isOpen = true;
+		}
+
+		bool IsOpen() const
+		{
+			return m_isOpen;
+		}
+
+		// Appends one member. The data is written with a single sequential write after its header.
+		void AddFile(const std::string& memberName, const void* pData, uint64_t size)
+		{
+			if (m_isOpen == false)
+				throw std::runtime_error(ErrorMessage(__FUNCTION__, "Archive is not open."));
+
+			std::string name = MemberName(memberName);
+			std::string paxRecords = (name.length() > 100) ? PaxPathRecord(name) : "";
+			uint64_t headerSize = TarBlockSize;
+			if (paxRecords.empty() == false)
+				headerSize += TarBlockSize + PaddedSize(paxRecords.size());
+			uint64_t memberSize = headerSize + PaddedSize(size);
+
+			// Leave room for the two zero blocks that terminate every archive.
+			if (m_archiveSize > 0 && m_archiveSize + memberSize + (TarBlockSize * 2) > m_maxArchiveSize)
+			{
+				CloseCurrentArchive();
+				m_archiveNumber++;
+				OpenNextArchive();
+			}
+
+			char header[TarBlockSize];
+			if (paxRecords.empty() == false)
+			{
+				BuildHeader(header, "PaxHeader/" + name, paxRecords.size(), 'x');
+				m_archiveFile.write(header, TarBlockSize);
+				m_archiveFile.write(paxRecords.c_str(), paxRecords.size());
+				WritePadding(paxRecords.size());
+			}
+
+			// Readers that do not understand pax headers fall back to the truncated name.
+			BuildHeader(header, name, size, '0');
+			m_archiveFile.write(header, TarBlockSize);
+			uint64_t dataOffset = m_archiveSize + headerSize;
+			m_archiveFile.write(reinterpret_cast<const char*>(pData), size);
+			WritePadding(size);
+
+			if (!m_archiveFile)
+				throw std::runtime_error(ErrorMessage(__FUNCTION__, "Could not write to archive: " + m_archiveName));
+
+			m_archiveSize += memberSize;
+
+			SMemberLocation location;
+			location.archiveName = m_archiveName;
+			location.dataOffset = dataOffset;
+			location.size = size;
+			m_members[name] = location;
+
+			WriteIndexLine(location, name);
+		}
+
+		// Adds an index entry for memberName that points at the data of an already archived member,
+		// so an identical image is only stored once.
+		void AddReference(const std::string& memberName, const std::string& existingMemberName)
+		{
+			if (m_isOpen == false)
+				throw std::runtime_error(ErrorMessage(__FUNCTION__, "Archive is not open."));
+
+			std::string name = MemberName(memberName);
+			std::map<std::string, SMemberLocation>::const_iterator existing = m_members.find(MemberName(existingMemberName));
+			if (existing == m_members.end())
+				throw std::runtime_error(ErrorMessage(__FUNCTION__, "Member is not in the archive: " + existingMemberName));
+
+			WriteIndexLine(existing->second, name);
+		}
+
+		void Close()
+		{
+			if (m_isOpen == false)
+				return;
+
+			m_isOpen = false;
+			CloseCurrentArchive();
+			m_indexFile.close();
+		}
+
+		std::string CurrentArchiveName() const
+		{
+			return m_archiveName;
+		}
+
+	private:
+		struct SMemberLocation
+		{
+			std::string archiveName;
+			uint64_t dataOffset;
+			uint64_t size;
+		};
+
+		void WriteIndexLine(const SMemberLocation& location, const std::string& name)
+		{
+			m_indexFile << location.archiveName << "\t" << location.dataOffset << "\t" << location.size << "\t" << name << std::endl;
+		}
+
+		std::string ErrorMessage(const char* function, const std::string& message) const
+		{
+			std::string errorMessage = "ERROR: ";
+			errorMessage.append(function);
+			errorMessage.append("(): ");
+			errorMessage.append(message);
+			return errorMessage;
+		}
+
+		static uint64_t PaddedSize(uint64_t size)
+		{
+			return ((size + TarBlockSize - 1) / TarBlockSize) * TarBlockSize;
+		}
+
+		// Strip any directory part.
+		std::string MemberName(const std::string& fileName) const
+		{
+			std::string name = fileName;
+			size_t lastSlash = name.find_last_of("/\\");
+			if (lastSlash != std::string::npos)
+				name = name.substr(lastSlash + 1);
+
+			if (name.empty())
+				throw std::runtime_error(ErrorMessage(__FUNCTION__, "Member name is empty: " + fileName));
+
+			return name;
+		}
+
+		// One pax "path" record: "<length> path=<name>\n", where length counts the whole record including its own digits.
+		static std::string PaxPathRecord(const std::string& name)
+		{
+			std::string body = " path=" + name + "\n";
+			size_t length = body.length() + 1;
+			while (std::to_string(length).length() + body.length() != length)
+				length = std::to_string(length).length() + body.length();
+			return std::to_string(length) + body;
+		}
+
+		void WritePadding(uint64_t size)
+		{
+			uint64_t padding = PaddedSize(size) - size;
+			if (padding > 0)
+			{
+				char zeros[TarBlockSize];
+				memset(zeros, 0, TarBlockSize);
+				m_archiveFile.write(zeros, padding);
+			}
+		}
+
+		static void WriteOctal(char* pField, size_t fieldSize, uint64_t value)
+		{
+			// Field is zero padded octal with a trailing NUL.
+			memset(pField, '0', fieldSize - 1);
+			pField[fieldSize - 1] = '\0';
+			for (size_t i = fieldSize - 1; i > 0 && value > 0; i--)
+			{
+				pField[i - 1] = static_cast<char>('0' + (value & 7));
+				value >>= 3;
+			}
+		}
+
+		// typeFlag '0' is a regular file, 'x' a pax extended header for the member that follows. Names are cut at 100 characters.
+		void BuildHeader(char* pHeader, const std::string& name, uint64_t size, char typeFlag) const
+		{
+			if (size >= (1ULL << 33))
+				throw std::runtime_error(ErrorMessage(__FUNCTION__, "Member is too large for a ustar archive: " + name));
+
+			memset(pHeader, 0, TarBlockSize);
+			memcpy(pHeader, name.c_str(), std::min<size_t>(name.length(), 100)); // name
+			WriteOctal(pHeader + 100, 8, 0644);            // mode
+			WriteOctal(pHeader + 108, 8, 0);               // uid
+			WriteOctal(pHeader + 116, 8, 0);               // gid
+			WriteOctal(pHeader + 124, 12, size);           // size
+			WriteOctal(pHeader + 136, 12, static_cast<uint64_t>(time(NULL))); // mtime
+			pHeader[156] = typeFlag;                       // typeflag
+			memcpy(pHeader + 257, "ustar", 6);             // magic
+			memcpy(pHeader + 263, "00", 2);                // version
+
+			// The checksum is computed with the checksum field itself filled with spaces.
+			memset(pHeader + 148, ' ', 8);
+			uint32_t checksum = 0;
+			for (size_t i = 0; i < TarBlockSize; i++)
+				checksum += static_cast<unsigned char>(pHeader[i]);
+			WriteOctal(pHeader + 148, 7, checksum);
+			pHeader[155] = ' ';
+		}
+
+		void OpenNextArchive()
+		{
+			char number[16];
+			snprintf(number, sizeof(number), "_%04u.tar", m_archiveNumber);
+			m_archiveName = m_baseName + number;
+			m_archiveSize = 0;
+
+			m_archiveFile.open(m_archiveName.c_str(), std::ofstream::binary | std::ofstream::out | std::ofstream::trunc);
+			if (!m_archiveFile)
+				throw std::runtime_error(ErrorMessage(__FUNCTION__, "Archive could not be created: " + m_archiveName));
+		}
+
+		void CloseCurrentArchive()
+		{
+			if (m_archiveFile.is_open() == false)
+				return;
+
+			char zeros[TarBlockSize * 2];
+			memset(zeros, 0, sizeof(zeros));
+			m_archiveFile.write(zeros, sizeof(zeros));
+			m_archiveFile.close();
+
+			if (!m_archiveFile)
+				throw std::runtime_error(ErrorMessage(__FUNCTION__, "Could not finish archive: " + m_archiveName));
+		}
+
+		std::string m_baseName;
+		std::string m_archiveName;
+		uint64_t m_maxArchiveSize;
+		uint32_t m_archiveNumber;
+		uint64_t m_archiveSize;
+		bool m_isOpen;
+		std::ofstream m_archiveFile;
+		std::ofstream m_indexFile;
+		std::map<std::string, SMemberLocation> m_members;
+	};
+}
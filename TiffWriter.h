@@ -0,0 +1,400 @@
+// TiffWriter.h
+// Writes baseline TIFF files with uncompressed, PackBits, LZW or Deflate strips.
+// Strips are compressed independently, so they are spread over all cores.
+// LZW and Deflate can use the horizontal differencing predictor, which helps a lot on camera images.
+//
+// Copyright (c) 2019 Matthew Breit - matt.breit@baslerweb.com or matt.breit@gmail.com
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http ://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "EncoderUtilities.h"
+#include <zlib.h>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <stdint.h>
+
+namespace TiffWriter
+{
+	enum ETiffCompression
+	{
+		TiffCompression_None = 0,
+		TiffCompression_PackBits = 1,
+		TiffCompression_Lzw = 2,
+		TiffCompression_Deflate = 3
+	};
+
+	struct STiffOptions
+	{
+		STiffOptions() : compression(TiffCompression_None), predictor(true), deflateLevel(6), threads(0)
+		{
+		}
+
+		ETiffCompression compression;
+		bool predictor;        // horizontal differencing, used with LZW and Deflate only.
+		int deflateLevel;      // 1 (fastest) to 9 (smallest).
+		unsigned int threads;  // 0 uses all hardware threads.
+	};
+
+	const size_t TargetStripBytes = 256 * 1024;
+
+	// TIFF LZW: MSB-first codes of 9 to 12 bits, with the decoder-side "early change" of the code width.
+	class CLzwEncoder
+	{
+	public:
+		void Encode(const uint8_t* pData, size_t size, std::vector<char>& out)
+		{
+			m_pOut = &out;
+			m_bitBuffer = 0;
+			m_bitCount = 0;
+
+			ResetTable();
+			PutCode(ClearCode);
+
+			if (size > 0)
+			{
+				uint32_t prefix = pData[0];
+				for (size_t i = 1; i < size; i++)
+				{
+					uint32_t key = (prefix << 8) | pData[i];
+					int code = Find(key);
+					if (code >= 0)
+					{
+						prefix = static_cast<uint32_t>(code);
+						continue;
+					}
+
+					PutCode(prefix);
+					Insert(key, m_nextCode);
+					AdvanceCode();
+					prefix = pData[i];
+				}
+
+				// The decoder adds one more entry when it reads the last code, which can widen the EOI code.
+				PutCode(prefix);
+				AdvanceCode();
+			}
+
+			PutCode(EndOfInformationCode);
+
+			if (m_bitCount > 0)
+				m_pOut->push_back(static_cast<char>((m_bitBuffer << (8 - m_bitCount)) & 0xFF));
+		}
+
+	private:
+		static const uint32_t ClearCode = 256;
+		static const uint32_t EndOfInformationCode = 257;
+		static const uint32_t FirstCode = 258;
+		static const uint32_t LastCode = 4094;
+		static const size_t TableSize = 8192;
+
+		void ResetTable()
+		{
+			m_keys.assign(TableSize, -1);
+			m_codes.resize(TableSize);
+			m_nextCode = FirstCode;
+			m_codeWidth = 9;
+		}
+
+		void AdvanceCode()
+		{
+			m_nextCode++;
+			if (m_nextCode == LastCode)
+			{
+				PutCode(ClearCode);
+				ResetTable();
+			}
+			else if (m_nextCode > (1u << m_codeWidth) - 1)
+			{
+				m_codeWidth++;
+			}
+		}
+
+		int Find(uint32_t key) const
+		{
+			size_t slot = (key * 2654435761u) & (TableSize - 1);
+			while (m_keys[slot] != -1)
+			{
+				if (static_cast<uint32_t>(m_keys[slot]) == key)
+					return m_codes[slot];
+				slot = (slot + 1) & (TableSize - 1);
+			}
+			return -1;
+		}
+
+		void Insert(uint32_t key, uint32_t code)
+		{
+			size_t slot = (key * 2654435761u) & (TableSize - 1);
+			while (m_keys[slot] != -1)
+				slot = (slot + 1) & (TableSize - 1);
+			m_keys[slot] = static_cast<int32_t>(key);
+			m_codes[slot] = static_cast<uint16_t>(code);
+		}
+
+		void PutCode(uint32_t code)
+		{
+			m_bitBuffer = (m_bitBuffer << m_codeWidth) | code;
+			m_bitCount += m_codeWidth;
+			while (m_bitCount >= 8)
+			{
+				m_bitCount -= 8;
+				m_pOut->push_back(static_cast<char>((m_bitBuffer >> m_bitCount) & 0xFF));
+			}
+		}
+
+		std::vector<char>* m_pOut;
+		uint64_t m_bitBuffer;
+		uint32_t m_bitCount;
+		std::vector<int32_t> m_keys;
+		std::vector<uint16_t> m_codes;
+		uint32_t m_nextCode;
+		uint32_t m_codeWidth;
+	};
+
+	// PackBits never lets a run cross a row boundary.
+	inline void PackBitsRow(const uint8_t* pRow, size_t size, std::vector<char>& out)
+	{
+		size_t i = 0;
+		while (i < size)
+		{
+			size_t run = 1;
+			while (i + run < size && run < 128 && pRow[i + run] == pRow[i])
+				run++;
+
+			if (run >= 3)
+			{
+				out.push_back(static_cast<char>(1 - static_cast<int>(run)));
+				out.push_back(static_cast<char>(pRow[i]));
+				i += run;
+				continue;
+			}
+
+			size_t start = i;
+			while (i < size && i - start < 128)
+			{
+				if (i + 2 < size && pRow[i] == pRow[i + 1] && pRow[i] == pRow[i + 2])
+					break;
+				i++;
+			}
+			out.push_back(static_cast<char>(i - start - 1));
+			out.insert(out.end(), pRow + start, pRow + i);
+		}
+	}
+
+	inline void ApplyPredictor(uint8_t* pStrip, size_t rows, size_t rowBytes, uint32_t samplesPerPixel, uint32_t bitDepth)
+	{
+		for (size_t row = 0; row < rows; row++)
+		{
+			uint8_t* pRow = pStrip + row * rowBytes;
+			if (bitDepth == 16)
+			{
+				// Samples are little endian, which is also the byte order of the file.
+				size_t samples = rowBytes / 2;
+				for (size_t i = samples - 1; i >= samplesPerPixel; i--)
+				{
+					uint16_t current = static_cast<uint16_t>(pRow[i * 2] | (pRow[i * 2 + 1] << 8));
+					uint16_t left = static_cast<uint16_t>(pRow[(i - samplesPerPixel) * 2] | (pRow[(i - samplesPerPixel) * 2 + 1] << 8));
+					uint16_t difference = static_cast<uint16_t>(current - left);
+					pRow[i * 2] = static_cast<uint8_t>(difference & 0xFF);
+					pRow[i * 2 + 1] = static_cast<uint8_t>(difference >> 8);
+				}
+			}
+			else
+			{
+				for (size_t i = rowBytes - 1; i >= samplesPerPixel; i--)
+					pRow[i] = static_cast<uint8_t>(pRow[i] - pRow[i - samplesPerPixel]);
+			}
+		}
+	}
+
+	inline void AppendUInt16(std::vector<char>& out, uint16_t value)
+	{
+		out.push_back(static_cast<char>(value & 0xFF));
+		out.push_back(static_cast<char>(value >> 8));
+	}
+
+	inline void AppendUInt32(std::vector<char>& out, uint32_t value)
+	{
+		AppendUInt16(out, static_cast<uint16_t>(value & 0xFFFF));
+		AppendUInt16(out, static_cast<uint16_t>(value >> 16));
+	}
+
+	inline void AppendEntry(std::vector<char>& ifd, uint16_t tag, uint16_t type, uint32_t count, uint32_t valueOrOffset)
+	{
+		AppendUInt16(ifd, tag);
+		AppendUInt16(ifd, type);
+		AppendUInt32(ifd, count);
+		if (type == 3 && count == 1)
+		{
+			AppendUInt16(ifd, static_cast<uint16_t>(valueOrOffset)); // SHORT values are left justified.
+			AppendUInt16(ifd, 0);
+		}
+		else
+		{
+			AppendUInt32(ifd, valueOrOffset);
+		}
+	}
+
+	// pPixels: rows of 'samplesPerPixel' (1 gray or 3 RGB) interleaved samples of 'bitDepth' (8 or 16, little endian) bits.
+	inline void Encode(const void* pPixels, uint32_t width, uint32_t height, size_t stride, uint32_t samplesPerPixel, uint32_t bitDepth, const STiffOptions& options, std::vector<char>& tiff)
+	{
+		std::string errorMessage = "ERROR: ";
+		errorMessage.append(__FUNCTION__);
+		errorMessage.append("(): ");
+
+		if (width == 0 || height == 0)
+			throw std::runtime_error(errorMessage + "Width and Height must be greater than 0.");
+		if (samplesPerPixel != 1 && samplesPerPixel != 3)
+			throw std::runtime_error(errorMessage + "Only gray and RGB images are supported.");
+		if (bitDepth != 8 && bitDepth != 16)
+			throw std::runtime_error(errorMessage + "Only 8 and 16 bit samples are supported.");
+		if (options.compression < TiffCompression_None || options.compression > TiffCompression_Deflate)
+			throw std::runtime_error(errorMessage + "Compression must be 0 to 3.");
+		if (options.deflateLevel < 1 || options.deflateLevel > 9)
+			throw std::runtime_error(errorMessage + "Deflate level must be 1 to 9.");
+
+		const size_t rowBytes = static_cast<size_t>(width) * samplesPerPixel * (bitDepth / 8);
+		if (stride < rowBytes)
+			throw std::runtime_error(errorMessage + "Stride is smaller than a row.");
+
+		const bool usePredictor = options.predictor && (options.compression == TiffCompression_Lzw || options.compression == TiffCompression_Deflate);
+		const size_t rowsPerStrip = std::min(static_cast<size_t>(height), std::max(static_cast<size_t>(1), TargetStripBytes / rowBytes));
+		const size_t stripCount = (height + rowsPerStrip - 1) / rowsPerStrip;
+		const uint8_t* pSource = static_cast<const uint8_t*>(pPixels);
+
+		std::vector<std::vector<char> > strips(stripCount);
+
+		EncoderUtilities::ParallelFor(stripCount, options.threads, [&](size_t strip)
+		{
+			size_t firstRow = strip * rowsPerStrip;
+			size_t rows = std::min(rowsPerStrip, static_cast<size_t>(height) - firstRow);
+
+			std::vector<uint8_t> data(rows * rowBytes);
+			for (size_t row = 0; row < rows; row++)
+				memcpy(&data[row * rowBytes], pSource + (firstRow + row) * stride, rowBytes);
+
+			if (usePredictor)
+				ApplyPredictor(&data[0], rows, rowBytes, samplesPerPixel, bitDepth);
+
+			std::vector<char>& out = strips[strip];
+			switch (options.compression)
+			{
+				case TiffCompression_PackBits:
+					out.reserve(data.size() + data.size() / 128 + rows);
+					for (size_t row = 0; row < rows; row++)
+						PackBitsRow(&data[row * rowBytes], rowBytes, out);
+					break;
+				case TiffCompression_Lzw:
+				{
+					out.reserve(data.size() / 2);
+					CLzwEncoder encoder;
+					encoder.Encode(&data[0], data.size(), out);
+					break;
+				}
+				case TiffCompression_Deflate:
+				{
+					uLongf compressedSize = compressBound(static_cast<uLong>(data.size()));
+					out.resize(compressedSize);
+					if (compress2(reinterpret_cast<Bytef*>(&out[0]), &compressedSize, &data[0], static_cast<uLong>(data.size()), options.deflateLevel) != Z_OK)
+						throw std::runtime_error(errorMessage + "Deflate failed.");
+					out.resize(compressedSize);
+					break;
+				}
+				default:
+					out.assign(data.begin(), data.end());
+					break;
+			}
+		});
+
+		// Layout: header, strips, then the out-of-line tag values and the IFD.
+		uint64_t totalSize = 8;
+		for (size_t strip = 0; strip < stripCount; strip++)
+			totalSize += strips[strip].size();
+		if (totalSize + stripCount * 8 + 1024 > 0xFFFFFFFFULL)
+			throw std::runtime_error(errorMessage + "Image is too large for a classic TIFF file.");
+
+		tiff.clear();
+		tiff.reserve(static_cast<size_t>(totalSize + stripCount * 8 + 256));
+		tiff.push_back('I');
+		tiff.push_back('I');
+		AppendUInt16(tiff, 42);
+		AppendUInt32(tiff, 0); // IFD offset, patched below.
+
+		std::vector<uint32_t> stripOffsets(stripCount);
+		std::vector<uint32_t> stripByteCounts(stripCount);
+		for (size_t strip = 0; strip < stripCount; strip++)
+		{
+			stripOffsets[strip] = static_cast<uint32_t>(tiff.size());
+			stripByteCounts[strip] = static_cast<uint32_t>(strips[strip].size());
+			tiff.insert(tiff.end(), strips[strip].begin(), strips[strip].end());
+			std::vector<char>().swap(strips[strip]);
+		}
+
+		if (tiff.size() & 1)
+			tiff.push_back(0);
+
+		uint32_t bitsPerSampleOffset = static_cast<uint32_t>(tiff.size());
+		if (samplesPerPixel > 2)
+			for (uint32_t i = 0; i < samplesPerPixel; i++)
+				AppendUInt16(tiff, static_cast<uint16_t>(bitDepth));
+
+		uint32_t resolutionOffset = static_cast<uint32_t>(tiff.size());
+		AppendUInt32(tiff, 72); // 72/1 dpi, for both X and Y.
+		AppendUInt32(tiff, 1);
+
+		uint32_t stripOffsetsOffset = stripOffsets[0];
+		uint32_t stripByteCountsOffset = stripByteCounts[0];
+		if (stripCount > 1)
+		{
+			stripOffsetsOffset = static_cast<uint32_t>(tiff.size());
+			for (size_t strip = 0; strip < stripCount; strip++)
+				AppendUInt32(tiff, stripOffsets[strip]);
+			stripByteCountsOffset = static_cast<uint32_t>(tiff.size());
+			for (size_t strip = 0; strip < stripCount; strip++)
+				AppendUInt32(tiff, stripByteCounts[strip]);
+		}
+
+		static const uint16_t compressionTags[] = { 1, 32773, 5, 8 };
+
+		std::vector<char> ifd;
+		AppendEntry(ifd, 256, 4, 1, width);
+		AppendEntry(ifd, 257, 4, 1, height);
+		AppendEntry(ifd, 258, 3, samplesPerPixel, (samplesPerPixel > 2) ? bitsPerSampleOffset : bitDepth);
+		AppendEntry(ifd, 259, 3, 1, compressionTags[options.compression]);
+		AppendEntry(ifd, 262, 3, 1, (samplesPerPixel == 1) ? 1 : 2); // BlackIsZero or RGB
+		AppendEntry(ifd, 273, 4, static_cast<uint32_t>(stripCount), stripOffsetsOffset);
+		AppendEntry(ifd, 277, 3, 1, samplesPerPixel);
+		AppendEntry(ifd, 278, 4, 1, static_cast<uint32_t>(rowsPerStrip));
+		AppendEntry(ifd, 279, 4, static_cast<uint32_t>(stripCount), stripByteCountsOffset);
+		AppendEntry(ifd, 282, 5, 1, resolutionOffset);
+		AppendEntry(ifd, 283, 5, 1, resolutionOffset);
+		AppendEntry(ifd, 284, 3, 1, 1);   // PlanarConfiguration: chunky
+		AppendEntry(ifd, 296, 3, 1, 2);   // ResolutionUnit: inch
+		if (usePredictor)
+			AppendEntry(ifd, 317, 3, 1, 2); // Predictor: horizontal differencing
+
+		uint32_t ifdOffset = static_cast<uint32_t>(tiff.size());
+		AppendUInt16(tiff, static_cast<uint16_t>(ifd.size() / 12));
+		tiff.insert(tiff.end(), ifd.begin(), ifd.end());
+		AppendUInt32(tiff, 0); // no next IFD
+
+		tiff[4] = static_cast<char>(ifdOffset & 0xFF);
+		tiff[5] = static_cast<char>((ifdOffset >> 8) & 0xFF);
+		tiff[6] = static_cast<char>((ifdOffset >> 16) & 0xFF);
+		tiff[7] = static_cast<char>((ifdOffset >> 24) & 0xFF);
+	}
+}